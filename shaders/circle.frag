@@ -3,5 +3,7 @@ in vec3 outColor;
 out vec4 fColor;
 
 void main(){
+	vec2 coord = gl_PointCoord * 2.0 - 1.0;
+	if (dot(coord, coord) > 1.0) discard;
 	fColor = vec4(outColor, 1.0);
-}
\ No newline at end of file
+}
@@ -1,11 +1,16 @@
 #version 430 core
-layout (location = 0) in vec2 aPos;
+layout (std430, binding = 0) readonly buffer Pos { vec2 pos[]; };
+layout (std430, binding = 10) readonly buffer FramePos { vec2 framePos[]; };
 uniform mat4 projection;
+uniform float alpha; // interpolation between the previous and the latest simulated frame
+uniform float radius;
+uniform vec2 viewportSize;
 out vec3 outColor;
 
 void main(){
-    gl_Position = projection * vec4(aPos, 0.0, 1.0);
-    // gl_Position = vec4(aPos, 0.0, 1.0);
-    gl_PointSize = 100.0;
+    // vertex pulling, one point per particle straight from the solver's position buffer
+    gl_Position = projection * vec4(mix(framePos[gl_VertexID], pos[gl_VertexID], alpha), 0.0, 1.0);
+    // diameter in pixels: the orthographic projection scales lengths by projection[0][0] into NDC
+    gl_PointSize = max(radius * projection[0][0] * viewportSize.x, 1.0);
     outColor = vec3(0.0, 0.64, 1.0);
-}
\ No newline at end of file
+}
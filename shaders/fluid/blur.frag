@@ -0,0 +1,32 @@
+#version 430 core
+in vec2 uv;
+layout (location = 0) out float height;
+
+uniform sampler2D heightMap;
+uniform vec2 direction;     // one texel along the blur axis, in uv units
+uniform int filterRadius;   // in texels
+uniform float depthFalloff; // penalizes averaging across height discontinuities
+
+// One axis of a separable bilateral filter on the splatted height field
+void main(){
+    float center = texture(heightMap, uv).r;
+    if (center <= 0.0){
+        height = 0.0;
+        return;
+    }
+
+    float sigma = max(float(filterRadius) / 2.0, 1.0);
+    float sum = 0.0;
+    float wsum = 0.0;
+    for (int i = -filterRadius; i <= filterRadius; i++){
+        float s = texture(heightMap, uv + float(i) * direction).r;
+        if (s <= 0.0) continue; // outside the fluid
+
+        float ds = (s - center) * depthFalloff;
+        float w = exp(-float(i * i) / (2.0 * sigma * sigma)) * exp(-ds * ds);
+        sum += s * w;
+        wsum += w;
+    }
+
+    height = sum / wsum;
+}
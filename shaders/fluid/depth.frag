@@ -0,0 +1,14 @@
+#version 430 core
+uniform float radius;
+layout (location = 0) out float height;
+
+// Each particle is splatted as a sphere seen from above, the nearest (tallest) one wins the depth test
+void main(){
+    vec2 coord = gl_PointCoord * 2.0 - 1.0;
+    float r2 = dot(coord, coord);
+    if (r2 > 1.0) discard;
+
+    float h = sqrt(1.0 - r2);
+    height = h * radius;
+    gl_FragDepth = 0.5 - 0.5 * h;
+}
@@ -0,0 +1,40 @@
+#version 430 core
+in vec2 uv;
+out vec4 fColor;
+
+uniform sampler2D heightMap;
+uniform sampler2D thicknessMap;
+uniform vec2 texel;       // one texel in uv units
+uniform vec2 texelWorld;  // one texel in world units
+uniform vec3 absorption;  // Beer-Lambert coefficients per colour channel
+
+const vec3 lightDir = normalize(vec3(-0.4, 0.6, 1.0));
+const vec3 background = vec3(1.0);
+
+// central difference, falling back to one-sided at the silhouette
+float Slope(float h, float left, float right){
+    if (left <= 0.0 && right <= 0.0) return 0.0;
+    if (left <= 0.0) return right - h;
+    if (right <= 0.0) return h - left;
+    return 0.5 * (right - left);
+}
+
+void main(){
+    float h = texture(heightMap, uv).r;
+    if (h <= 0.0) discard;
+
+    float dx = Slope(h, texture(heightMap, uv - vec2(texel.x, 0.0)).r, texture(heightMap, uv + vec2(texel.x, 0.0)).r);
+    float dy = Slope(h, texture(heightMap, uv - vec2(0.0, texel.y)).r, texture(heightMap, uv + vec2(0.0, texel.y)).r);
+    vec3 normal = normalize(vec3(-dx / texelWorld.x, -dy / texelWorld.y, 1.0));
+
+    float thickness = texture(thicknessMap, uv).r;
+    vec3 transmitted = background * exp(-absorption * thickness);
+
+    float diffuse = 0.6 + 0.4 * max(dot(normal, lightDir), 0.0);
+    vec3 halfway = normalize(lightDir + vec3(0.0, 0.0, 1.0));
+    float specular = pow(max(dot(normal, halfway), 0.0), 64.0);
+    float fresnel = 0.02 + 0.98 * pow(1.0 - normal.z, 5.0);
+
+    vec3 colour = mix(transmitted * diffuse, vec3(0.85, 0.93, 1.0), fresnel) + specular;
+    fColor = vec4(colour, 1.0);
+}
@@ -0,0 +1,12 @@
+#version 430 core
+layout (std430, binding = 0) readonly buffer Pos { vec2 pos[]; };
+layout (std430, binding = 10) readonly buffer FramePos { vec2 framePos[]; };
+uniform mat4 projection;
+uniform float alpha; // interpolation between the previous and the latest simulated frame
+uniform float radius;
+uniform vec2 viewportSize;
+
+void main(){
+    gl_Position = projection * vec4(mix(framePos[gl_VertexID], pos[gl_VertexID], alpha), 0.0, 1.0);
+    gl_PointSize = max(radius * projection[0][0] * viewportSize.x, 1.0);
+}
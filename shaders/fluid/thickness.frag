@@ -0,0 +1,12 @@
+#version 430 core
+uniform float radius;
+layout (location = 0) out float thickness;
+
+// Additively blended, accumulates how much fluid lies behind each pixel
+void main(){
+    vec2 coord = gl_PointCoord * 2.0 - 1.0;
+    float r2 = dot(coord, coord);
+    if (r2 > 1.0) discard;
+
+    thickness = 2.0 * sqrt(1.0 - r2) * radius;
+}
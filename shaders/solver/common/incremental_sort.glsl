@@ -0,0 +1,19 @@
+// ------- INCREMENTAL SORT STATE -------
+// Shared by the incremental resort kernels. The plan is written on the GPU and also holds the
+// indirect dispatch arguments, so the CPU records every path and never reads the change count.
+
+layout (std430, binding = 13) buffer SortPlan {
+    uint changedCount;      // entries whose cell changed, accumulated by the rehash
+    uint mergeArgs[3];      // indirect dispatch of the merge, empty unless fixing up
+    uint applyArgs[3];      // indirect dispatch of the copy back, empty when nothing changed
+    uint bitonicArgs[3];    // indirect dispatch of every bitonic step, empty unless resorting
+    uint fixupCount;        // changed entries the merge inserts
+    uint stats[4];          // skipped, fixed up, fully sorted, changed entries
+};
+
+layout (std430, binding = 14) buffer ChangedList {
+    uvec2 changed[FIXUP_CAPACITY];      // uvec2(index, new hash), sorted by the plan
+    uint changedSlot[FIXUP_CAPACITY];   // slot the entry had in the sorted index, ascending after the plan
+};
+
+// --------------------------------------
@@ -0,0 +1,280 @@
+// ------- SPATIAL HASHING TEMPLATE -------
+// Shared by every solver kernel that bins or searches particles, so a different search strategy
+// only has to be written here. Needs GRID_WIDTH, GRID_HEIGHT, CELL_SIZE and SEARCH_REACH, and the
+// search macros need the kernel to declare the buffers they walk.
+//
+// The search visits the cells within SEARCH_REACH of the particle's cell: 1 for cells as wide as
+// the support radius (3x3), 2 for half as wide (5x5). With QUADRANT_SEARCH the cells are twice
+// the support radius and only the 2x2 cells on the side of the particle's quadrant are visited.
+//
+// Spatial index entries are uvec2(particle index, cell hash), sorted by hash. The cell coordinates
+// are not stored, callers that need them recompute GetCellPos from the particle position.
+//
+// The Verlet list kernels (LIST_GRID) bin on cells sized from SMOOTHING_LENGTH + skin instead.
+// The skin is changed at runtime, so that grid comes in as uniforms rather than defines.
+
+#ifdef LIST_GRID
+uniform float listCellSize;
+uniform int listGridWidth;
+uniform int listGridHeight;
+
+#define CELL_SIZE listCellSize
+#define GRID_WIDTH listGridWidth
+#define GRID_HEIGHT listGridHeight
+#endif
+
+ivec2 GetCellPos(vec2 position, float cellSize){
+    int x = int(position.x / cellSize);
+    int y = int(position.y / cellSize);
+    
+    return ivec2(clamp(x, 1, GRID_WIDTH - 2), clamp(y, 1, GRID_HEIGHT - 2));
+}
+
+#ifdef MORTON_KEYS
+// Z-order keys: the bits of x and y interleaved, so cells close in 2D stay close in the sorted index
+
+uint SpreadBits(uint v){
+    v &= 0x0000FFFFu;
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+uint CompactBits(uint v){
+    v &= 0x55555555u;
+    v = (v | (v >> 1)) & 0x33333333u;
+    v = (v | (v >> 2)) & 0x0F0F0F0Fu;
+    v = (v | (v >> 4)) & 0x00FF00FFu;
+    v = (v | (v >> 8)) & 0x0000FFFFu;
+    return v;
+}
+
+uint Hash(ivec2 cellPos){
+    return SpreadBits(uint(cellPos.x)) | (SpreadBits(uint(cellPos.y)) << 1);
+}
+
+ivec2 CellFromHash(uint key){
+    return ivec2(CompactBits(key), CompactBits(key >> 1));
+}
+#else
+uint Hash(ivec2 cellPos){
+    return cellPos.x + cellPos.y * GRID_WIDTH;
+}
+
+ivec2 CellFromHash(uint key){
+    return ivec2(key % GRID_WIDTH, key / GRID_WIDTH);
+}
+#endif
+
+// first and last cell the search around position visits, inclusive
+void SearchRange(vec2 position, out ivec2 lo, out ivec2 hi){
+    ivec2 cell = GetCellPos(position, CELL_SIZE);
+#ifdef QUADRANT_SEARCH
+    // the support reaches into one neighbour per axis, the one on the side of the cell's half
+    vec2 local = position / CELL_SIZE - vec2(cell);
+    lo = cell - ivec2(lessThan(local, vec2(0.5)));
+    hi = lo + 1;
+#else
+    lo = cell - SEARCH_REACH;
+    hi = cell + SEARCH_REACH;
+#endif
+    lo = max(lo, ivec2(0));
+    hi = min(hi, ivec2(GRID_WIDTH - 1, GRID_HEIGHT - 1));
+}
+
+// Visits every fluid particle binned into the cells around position (SpatialIndex and
+// SpatialOffset). The body sees neighborIndex; `continue` skips a candidate and `break` leaves
+// the current cell.
+#define FOR_EACH_NEIGHBOR(position, neighborIndex) { \
+    ivec2 _lo, _hi; \
+    SearchRange(position, _lo, _hi); \
+    for (int _y = _lo.y; _y <= _hi.y; _y++) \
+    for (int _x = _lo.x; _x <= _hi.x; _x++){ \
+        uint _key = Hash(ivec2(_x, _y)); \
+        for (uint _slot = uint(spatialOffset[_key]); _slot < uint(spatialIndex.length()) && spatialIndex[_slot].y == _key; _slot++){ \
+            uint neighborIndex = spatialIndex[_slot].x;
+
+#define END_FOR_EACH_NEIGHBOR }}}
+
+// Same walk over the static wall particles (BoundaryIndex and BoundaryOffset)
+#define FOR_EACH_BOUNDARY(position, boundaryIdx) { \
+    ivec2 _lo, _hi; \
+    SearchRange(position, _lo, _hi); \
+    for (int _y = _lo.y; _y <= _hi.y; _y++) \
+    for (int _x = _lo.x; _x <= _hi.x; _x++){ \
+        uint _key = Hash(ivec2(_x, _y)); \
+        for (uint _slot = uint(boundaryOffset[_key]); _slot < uint(boundaryIndex.length()) && boundaryIndex[_slot].y == _key; _slot++){ \
+            uint boundaryIdx = boundaryIndex[_slot].x;
+
+#define END_FOR_EACH_BOUNDARY }}}
+
+#ifdef VERLET
+// Verlet lists: every particle keeps the neighbours within SMOOTHING_LENGTH + skin found at the
+// last rebuild, verletCapacity slots each, so the cells are only walked when the lists go stale.
+
+uniform uint verletCapacity;
+
+layout (std430, binding = 16) buffer VerletList { uint neighbourList[]; };
+layout (std430, binding = 17) buffer VerletCount { uint neighbourCount[]; };
+
+#define FOR_EACH_LISTED_NEIGHBOR(particle, neighborIndex) { \
+    uint _listStart = (particle) * verletCapacity; \
+    for (uint _entry = 0; _entry < neighbourCount[particle]; _entry++){ \
+        uint neighborIndex = neighbourList[_listStart + _entry];
+
+#define END_FOR_EACH_LISTED_NEIGHBOR }}
+#endif
+
+#if defined(TILED) || defined(CELL_CENTRIC)
+// Both stage the particles a workgroup can see in shared memory, tileCount of them. TileSlot(i)
+// is the sorted spatial index slot of the i-th, and GroupParticle() the slot of the thread's own
+// particle, false when the thread has none.
+#define SHARED_TILE
+
+shared uint tileCount;
+
+// first slot of the sorted spatial index whose hash is >= key
+uint LowerBound(uint key){
+    uint lo = 0;
+    uint hi = spatialIndex.length();
+    while (lo < hi){
+        uint mid = (lo + hi) / 2;
+        if (spatialIndex[mid].y < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+#endif
+
+#ifdef TILED
+// Tiled traversal: threads walk the particles in sorted order, and the workgroup stages every
+// particle its cells can see in shared memory. With row-major hashes and R = SEARCH_REACH the
+// neighbourhood of the group's hash range [first, last] is the contiguous range
+// [first - R * (GRID_WIDTH + 1), last + R * (GRID_WIDTH + 1)] of the sorted spatial index. Morton
+// keys grow with both coordinates, so every cell of the group's bounding box, grown by R cells,
+// lies between the keys of the box's corners. The quadrant search stays within R = 1.
+
+shared uint tileStart;
+#ifdef MORTON_KEYS
+shared uint tileMinX, tileMinY, tileMaxX, tileMaxY;
+#endif
+
+// must be reached by the whole workgroup
+void ComputeTileRange(){
+#ifdef MORTON_KEYS
+    if (gl_LocalInvocationIndex == 0){
+        tileMinX = tileMinY = 0xFFFFFFFFu;
+        tileMaxX = tileMaxY = 0u;
+    }
+    barrier();
+
+    if (gl_GlobalInvocationID.x < spatialIndex.length()){
+        ivec2 cell = CellFromHash(spatialIndex[gl_GlobalInvocationID.x].y);
+        atomicMin(tileMinX, uint(cell.x));
+        atomicMin(tileMinY, uint(cell.y));
+        atomicMax(tileMaxX, uint(cell.x));
+        atomicMax(tileMaxY, uint(cell.y));
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0){
+        ivec2 boxMin = max(ivec2(tileMinX, tileMinY) - SEARCH_REACH, ivec2(0));
+        ivec2 boxMax = min(ivec2(tileMaxX, tileMaxY) + SEARCH_REACH, ivec2(GRID_WIDTH - 1, GRID_HEIGHT - 1));
+        uint lo = LowerBound(Hash(boxMin));
+        uint hi = LowerBound(Hash(boxMax) + 1);
+        tileStart = lo;
+        tileCount = hi - lo;
+    }
+#else
+    if (gl_LocalInvocationIndex == 0){
+        uint numEntries = spatialIndex.length();
+        uint groupStart = gl_WorkGroupID.x * gl_WorkGroupSize.x;
+        uint groupEnd = min(groupStart + gl_WorkGroupSize.x, numEntries) - 1;
+        uint lo = LowerBound(uint(max(int(spatialIndex[groupStart].y) - SEARCH_REACH * (GRID_WIDTH + 1), 0)));
+        uint hi = LowerBound(spatialIndex[groupEnd].y + SEARCH_REACH * (GRID_WIDTH + 1) + 1);
+        tileStart = lo;
+        tileCount = hi - lo;
+    }
+#endif
+    barrier();
+}
+
+uint TileSlot(uint i){
+    return tileStart + i;
+}
+
+bool GroupParticle(out uint slot){
+    slot = gl_GlobalInvocationID.x;
+    return slot < spatialIndex.length();
+}
+#endif
+
+
+#ifdef CELL_CENTRIC
+// Cell-centric traversal: one workgroup per block of up to CELL_BLOCK particles of the same cell,
+// listed by spatial_offsets.comp. The group finds the particles of the cells around its cell once
+// and stages them for all of its threads. Blocks start at a cell's first slot or at a multiple of
+// CELL_BLOCK, so a block ends at the next of either.
+
+#define STENCIL_WIDTH (2 * SEARCH_REACH + 1)
+#define STENCIL_CELLS (STENCIL_WIDTH * STENCIL_WIDTH)
+
+layout (std430, binding = 19) buffer CellList { uint cellArgs[3]; uint cellBlocks[]; };
+
+shared uint blockStart;
+shared uint blockCount;
+shared ivec2 blockCell;
+shared uint stencilStart[STENCIL_CELLS];
+shared uint stencilBase[STENCIL_CELLS + 1];
+
+// must be reached by the whole workgroup
+void ComputeTileRange(){
+    if (gl_LocalInvocationIndex == 0){
+        uint start = cellBlocks[gl_WorkGroupID.x];
+        uint key = spatialIndex[start].y;
+        blockStart = start;
+        blockCount = min(LowerBound(key + 1), (start / CELL_BLOCK + 1) * CELL_BLOCK) - start;
+        blockCell = CellFromHash(key);
+    }
+    barrier();
+
+    // one thread per stencil cell, the quadrant search stays within the 3x3 around the cell
+    uint count = 0;
+    if (gl_LocalInvocationIndex < STENCIL_CELLS){
+        ivec2 cell = blockCell + ivec2(gl_LocalInvocationIndex % STENCIL_WIDTH, gl_LocalInvocationIndex / STENCIL_WIDTH) - SEARCH_REACH;
+        uint start = 0;
+        if (all(greaterThanEqual(cell, ivec2(0))) && all(lessThan(cell, ivec2(GRID_WIDTH, GRID_HEIGHT)))){
+            uint key = Hash(cell);
+            if (spatialOffset[key] >= 0){
+                start = uint(spatialOffset[key]);
+                count = LowerBound(key + 1) - start;
+            }
+        }
+        stencilStart[gl_LocalInvocationIndex] = start;
+        stencilBase[gl_LocalInvocationIndex + 1] = count;
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0){
+        stencilBase[0] = 0;
+        for (int c = 0; c < STENCIL_CELLS; c++) stencilBase[c + 1] += stencilBase[c];
+        tileCount = stencilBase[STENCIL_CELLS];
+    }
+    barrier();
+}
+
+uint TileSlot(uint i){
+    uint c = 0;
+    while (i >= stencilBase[c + 1]) c++;
+    return stencilStart[c] + i - stencilBase[c];
+}
+
+bool GroupParticle(out uint slot){
+    slot = blockStart + gl_LocalInvocationIndex;
+    return gl_LocalInvocationIndex < blockCount;
+}
+#endif
+
+// ---------------------------------------
@@ -0,0 +1,24 @@
+// ------- NEIGHBOUR ACCOUNTING -------
+// Past maxNeighbors the density and correction kernels stop accumulating but keep counting, so a
+// truncated neighbourhood is reported instead of silently biasing the density. The counters are
+// summed over a frame's substeps and read back by the solver one frame late. Kernels including
+// this enable the subgroup extensions, see subgroup.glsl.
+
+#include "subgroup.glsl"
+
+uniform int maxNeighbors;
+
+layout (std430, binding = 20) buffer NeighbourCounts {
+    uint overflowCount;             // particles with more than maxNeighbors neighbours
+    uint listOverflowCount;         // Verlet lists that ran out of slots
+    uint maxCount;                  // most neighbours of any particle
+    uint histogram[NEIGHBOUR_BINS]; // NEIGHBOUR_BIN_WIDTH wide, the last bin takes everything above
+};
+
+void RecordNeighbourCount(int count){
+    ATOMIC_ADD_REDUCED(overflowCount, uint(count > maxNeighbors));
+    ATOMIC_MAX_REDUCED(maxCount, uint(count));
+    atomicAdd(histogram[min(count / NEIGHBOUR_BIN_WIDTH, NEIGHBOUR_BINS - 1)], 1u);
+}
+
+// ------------------------------------
\ No newline at end of file
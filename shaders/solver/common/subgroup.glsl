@@ -0,0 +1,104 @@
+// ------- SUBGROUP PRIMITIVES -------
+// Scans, appends and counter reductions for the binning, compaction and diagnostic kernels. With
+// SUBGROUPS the solver found GL_KHR_shader_subgroup arithmetic and ballot for compute shaders, and
+// the kernel enables both extensions right after #version:
+//
+//     #ifdef SUBGROUPS
+//     #extension GL_KHR_shader_subgroup_arithmetic : require
+//     #extension GL_KHR_shader_subgroup_ballot : require
+//     #endif
+//
+// Without it the workgroup scan runs over shared memory. WorkgroupInclusiveAdd() and the
+// shared memory APPEND_SLOT hold barriers and must be reached by the whole workgroup.
+
+shared uint groupPartials[LOCAL_SIZE];
+shared uint groupTotal;
+
+#ifdef SUBGROUPS
+// inclusive prefix sum of value in invocation order, total gets the workgroup's sum
+uint WorkgroupInclusiveAdd(uint value, out uint total){
+    uint inclusive = subgroupInclusiveAdd(value);
+    uint subgroupTotal = subgroupAdd(value);
+    if (subgroupElect()) groupPartials[gl_SubgroupID] = subgroupTotal;
+    barrier();
+
+    // the first subgroup scans the subgroup totals, gl_SubgroupSize of them at a time
+    if (gl_SubgroupID == 0){
+        uint carry = 0;
+        for (uint base = 0; base < gl_NumSubgroups; base += gl_SubgroupSize){
+            uint i = base + gl_SubgroupInvocationID;
+            uint partial = i < gl_NumSubgroups ? groupPartials[i] : 0;
+            uint scanned = carry + subgroupExclusiveAdd(partial);
+            if (i < gl_NumSubgroups) groupPartials[i] = scanned;
+            carry += subgroupAdd(partial);
+        }
+        if (subgroupElect()) groupTotal = carry;
+    }
+    barrier();
+
+    uint result = groupPartials[gl_SubgroupID] + inclusive;
+    total = groupTotal;
+    barrier();
+    return result;
+}
+
+// Declares slot, the next free index of the buffer counter for the invocations with keep set.
+// One atomic per subgroup, and no barrier so it may sit in divergent code.
+#define APPEND_SLOT(counter, keep, slot) \
+    uint slot; { \
+        uvec4 _ballot = subgroupBallot(keep); \
+        uint _base = 0; \
+        if (subgroupElect()) _base = atomicAdd(counter, subgroupBallotBitCount(_ballot)); \
+        slot = subgroupBroadcastFirst(_base) + subgroupBallotExclusiveBitCount(_ballot); \
+    }
+
+// one atomic per subgroup on a buffer counter
+#define ATOMIC_ADD_REDUCED(counter, value) { \
+        uint _sum = subgroupAdd(value); \
+        if (subgroupElect() && _sum > 0u) atomicAdd(counter, _sum); \
+    }
+
+#define ATOMIC_MAX_REDUCED(counter, value) { \
+        uint _max = subgroupMax(value); \
+        if (subgroupElect()) atomicMax(counter, _max); \
+    }
+#else
+uint WorkgroupInclusiveAdd(uint value, out uint total){
+    uint localIndex = gl_LocalInvocationIndex;
+    groupPartials[localIndex] = value;
+    barrier();
+
+    for (uint offset = 1; offset < LOCAL_SIZE; offset <<= 1){
+        uint previous = localIndex >= offset ? groupPartials[localIndex - offset] : 0;
+        barrier();
+        groupPartials[localIndex] += previous;
+        barrier();
+    }
+
+    uint result = groupPartials[localIndex];
+    total = groupPartials[LOCAL_SIZE - 1];
+    barrier();
+    return result;
+}
+
+// one atomic per workgroup, must be reached by the whole workgroup
+#define APPEND_SLOT(counter, keep, slot) \
+    uint slot; { \
+        uint _count; \
+        uint _offset = WorkgroupInclusiveAdd(uint(keep), _count) - uint(keep); \
+        if (gl_LocalInvocationIndex == 0) groupTotal = atomicAdd(counter, _count); \
+        barrier(); \
+        slot = groupTotal + _offset; \
+        barrier(); \
+    }
+
+// the diagnostics are recorded from divergent code, so these stay per invocation
+#define ATOMIC_ADD_REDUCED(counter, value) { \
+        uint _sum = (value); \
+        if (_sum > 0u) atomicAdd(counter, _sum); \
+    }
+
+#define ATOMIC_MAX_REDUCED(counter, value) atomicMax(counter, value)
+#endif
+
+// ----------------------------------
@@ -0,0 +1,17 @@
+// ------- VERLET LIST STATE -------
+// Shared by the Verlet list kernels. The rebuild decision is made on the GPU and stored as
+// indirect dispatch arguments, an empty dispatch skipping the rebuild.
+
+layout (std430, binding = 15) buffer VerletState {
+    uint maxDisplacement;   // float bits of the largest move since the last rebuild
+    uint particleArgs[3];   // one invocation per particle
+    uint gridArgs[3];       // one invocation per cell
+    uint bitonicArgs[3];    // every bitonic step
+    uint stats[2];          // rebuilds, substeps
+};
+
+layout (std430, binding = 18) buffer VerletBuildPos { vec2 buildPos[]; };
+
+uniform float verletSkin;
+
+// ---------------------------------
@@ -0,0 +1,24 @@
+// ------- WALL KICK -------
+// Pushes particles that come within radius of the four domain walls back inside.
+// Needs the dt, viewWidth, viewHeight and radius uniforms.
+
+vec3 boundaries[] = vec3[](
+    vec3(-1.0, 0.0, -viewWidth),
+    vec3(0.0, -1.0, -viewHeight),
+    vec3(1.0, 0.0, 0.0),
+    vec3(0.0, 1.0, 0.0)
+);
+
+vec2 WallKick(vec2 position, vec2 velocity){
+    for (int i = 0; i < boundaries.length(); i++){
+        vec3 boundary = boundaries[i];
+        vec2 normal = boundary.xy;
+        float distance = dot(position, normal) - boundary.z;
+        if ((distance = max(distance, 0.0)) < radius){
+            velocity += (radius - distance) * normal / dt;
+        }
+    }
+    return velocity;
+}
+
+// -------------------------
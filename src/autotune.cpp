@@ -0,0 +1,260 @@
+#include "autotune.hpp"
+#include "benchmark.hpp"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <limits>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <utility>
+
+namespace tune{
+    static const int MIN_LOCAL_SIZE = 32;
+    static const int MAX_LOCAL_SIZE = 1024;
+    // a candidate has to beat the current best by this fraction, below it timings are noise
+    static const double MIN_GAIN = 0.03;
+    static const int MAX_ROUNDS = 3;
+
+    template <typename T>
+    using Names = std::vector<std::pair<T, const char*>>;
+
+    static const Names<bool> FUSED_NAMES = {{true, "fused"}, {false, "unfused"}};
+    static const Names<SortAlgorithm> SORT_NAMES = {
+        {SortAlgorithm::BITONIC, "bitonic"}, {SortAlgorithm::RADIX, "radix"}, {SortAlgorithm::INCREMENTAL, "incremental"}
+    };
+    static const Names<NeighbourTraversal> TRAVERSAL_NAMES = {
+        {NeighbourTraversal::GLOBAL, "global"}, {NeighbourTraversal::TILED, "tiled"},
+        {NeighbourTraversal::VERLET, "verlet"}, {NeighbourTraversal::CELLS, "cells"}
+    };
+    static const Names<CellKeys> KEY_NAMES = {{CellKeys::ROW_MAJOR, "row"}, {CellKeys::MORTON, "morton"}};
+    static const Names<SearchStencil> STENCIL_NAMES = {
+        {SearchStencil::CELLS_3X3, "3x3"}, {SearchStencil::FINE_5X5, "5x5"}, {SearchStencil::QUADRANT_2X2, "2x2"}
+    };
+
+    template <typename T>
+    static const char* nameOf(const Names<T>& names, T value){
+        for (const auto& entry : names)
+            if (entry.first == value) return entry.second;
+        return "?";
+    }
+
+    template <typename T>
+    static bool parseName(const Names<T>& names, const std::string& name, T& value){
+        for (const auto& entry : names){
+            if (name != entry.second) continue;
+            value = entry.first;
+            return true;
+        }
+        return false;
+    }
+
+    std::string DeviceKey(){
+        const char* renderer = (const char*)glGetString(GL_RENDERER);
+        const char* version = (const char*)glGetString(GL_VERSION);
+        return std::string(renderer ? renderer : "unknown") + " / " + (version ? version : "unknown");
+    }
+
+    // one "device<TAB>kernel<TAB>size" line per tuned kernel
+    static bool parseLine(const std::string& line, std::string& device, std::string& kernel, int& size){
+        std::istringstream fields(line);
+        std::string value;
+        if (!std::getline(fields, device, '\t') || !std::getline(fields, kernel, '\t') || !std::getline(fields, value)) return false;
+        size = std::atoi(value.c_str());
+        return size > 0;
+    }
+
+    bool LoadLocalSizes(Solver& solver, const std::string& path){
+        std::ifstream file(path);
+        if (!file) return false;
+
+        std::string key = DeviceKey();
+        std::string line, device, kernel;
+        int size;
+        bool found = false;
+        while (std::getline(file, line)){
+            if (!parseLine(line, device, kernel, size) || device != key) continue;
+            solver.SetLocalSize(kernel, size);
+            found = true;
+        }
+        return found;
+    }
+
+    void SaveLocalSizes(const Solver& solver, const std::string& path){
+        std::string key = DeviceKey();
+
+        // keep what was tuned on other devices
+        std::vector<std::string> lines;
+        std::ifstream existing(path);
+        std::string line, device, kernel;
+        int size;
+        while (std::getline(existing, line))
+            if (parseLine(line, device, kernel, size) && device != key) lines.push_back(line);
+        existing.close();
+
+        for (const auto& name : Solver::TunableKernels())
+            lines.push_back(key + "\t" + name + "\t" + std::to_string(solver.GetLocalSize(name)));
+
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+        std::ofstream file(path, std::ios::trunc);
+        if (!file){
+            std::cerr << "TUNE::WARNING::CACHE_NOT_WRITABLE: " << path << std::endl;
+            return;
+        }
+        for (const auto& entry : lines) file << entry << "\n";
+    }
+
+    void TuneLocalSizes(Solver& solver, Particles& particles, int frames){
+        int maxInvocations = MAX_LOCAL_SIZE;
+        glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+        bool fused = solver.GetFusedKernels();
+        NeighbourTraversal traversal = solver.GetNeighbourTraversal();
+
+        for (const auto& kernel : Solver::TunableKernels()){
+            // the fused kernels and the passes they replace only run in their own mode
+            bool fusedKernel = kernel == "Integrate Hash" || kernel == "Correct Boundary";
+            int current = solver.GetLocalSize(kernel);
+            int bestSize = current;
+            double bestMs = std::numeric_limits<double>::infinity();
+
+            // a size the traversal overrides would time the same program at every candidate, so
+            // those are timed under the global traversal, the one their size is used by
+            bool pinned = solver.LocalSizePinned(kernel);
+            if (pinned) std::cout << kernel << " runs with a fixed size under the current traversal, tuned under global" << std::endl;
+
+            for (int size = MIN_LOCAL_SIZE; size <= std::min(MAX_LOCAL_SIZE, maxInvocations); size *= 2){
+                bench::Result result = bench::Run(solver, particles, kernel, [&](Solver& s){
+                    s.SetFusedKernels(fusedKernel);
+                    if (pinned) s.SetNeighbourTraversal(NeighbourTraversal::GLOBAL);
+                    s.SetLocalSize(kernel, size);
+                }, frames);
+
+                auto it = std::find_if(result.passes.begin(), result.passes.end(),
+                    [&](const PassTiming& t){ return t.name == kernel; });
+                if (it == result.passes.end()) break;
+                std::cout << std::left << std::setw(28) << kernel << std::right << std::setw(6) << size
+                          << std::fixed << std::setprecision(3) << std::setw(10) << it->ms << " ms/frame" << std::endl;
+                if (it->ms < bestMs){
+                    bestMs = it->ms;
+                    bestSize = size;
+                }
+            }
+
+            if (bestMs == std::numeric_limits<double>::infinity())
+                std::cout << kernel << " does not run in this configuration, kept " << current << std::endl;
+            solver.SetNeighbourTraversal(traversal);
+            solver.SetLocalSize(kernel, bestSize);
+        }
+        solver.SetFusedKernels(fused);
+    }
+
+    std::string Describe(const Strategy& strategy){
+        return std::string(nameOf(FUSED_NAMES, strategy.fusedKernels)) + " " + nameOf(SORT_NAMES, strategy.sortAlgorithm)
+             + " " + nameOf(TRAVERSAL_NAMES, strategy.traversal) + " " + nameOf(KEY_NAMES, strategy.cellKeys)
+             + " " + nameOf(STENCIL_NAMES, strategy.searchStencil);
+    }
+
+    void ApplyStrategy(Solver& solver, const Strategy& strategy){
+        solver.SetFusedKernels(strategy.fusedKernels);
+        solver.SetSortAlgorithm(strategy.sortAlgorithm);
+        solver.SetNeighbourTraversal(strategy.traversal);
+        solver.SetCellKeys(strategy.cellKeys);
+        solver.SetSearchStencil(strategy.searchStencil);
+    }
+
+    bool LoadStrategy(const std::string& path, Strategy& strategy){
+        std::ifstream file(path);
+        if (!file) return false;
+
+        std::string line;
+        while (std::getline(file, line)){
+            if (line.empty() || line[0] == '#') continue;
+            size_t split = line.find('=');
+            std::string axis = line.substr(0, split);
+            std::string value = split == std::string::npos ? "" : line.substr(split + 1);
+
+            bool known = false;
+            if      (axis == "kernels")   known = parseName(FUSED_NAMES, value, strategy.fusedKernels);
+            else if (axis == "sort")      known = parseName(SORT_NAMES, value, strategy.sortAlgorithm);
+            else if (axis == "traversal") known = parseName(TRAVERSAL_NAMES, value, strategy.traversal);
+            else if (axis == "keys")      known = parseName(KEY_NAMES, value, strategy.cellKeys);
+            else if (axis == "stencil")   known = parseName(STENCIL_NAMES, value, strategy.searchStencil);
+            if (!known) std::cerr << "TUNE::WARNING::UNKNOWN_STRATEGY_LINE: " << line << std::endl;
+        }
+        return true;
+    }
+
+    void SaveStrategy(const Strategy& strategy, const std::string& path, size_t numParticles){
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+        std::ofstream file(path, std::ios::trunc);
+        if (!file){
+            std::cerr << "TUNE::WARNING::CACHE_NOT_WRITABLE: " << path << std::endl;
+            return;
+        }
+        file << "# tuned on " << DeviceKey() << " with " << numParticles << " particles\n"
+             << "kernels=" << nameOf(FUSED_NAMES, strategy.fusedKernels) << "\n"
+             << "sort=" << nameOf(SORT_NAMES, strategy.sortAlgorithm) << "\n"
+             << "traversal=" << nameOf(TRAVERSAL_NAMES, strategy.traversal) << "\n"
+             << "keys=" << nameOf(KEY_NAMES, strategy.cellKeys) << "\n"
+             << "stencil=" << nameOf(STENCIL_NAMES, strategy.searchStencil) << "\n";
+    }
+
+    // the strategy with one axis set to each of its values
+    template <typename T>
+    static void vary(const Strategy& base, T Strategy::*axis, const Names<T>& names, std::vector<Strategy>& candidates){
+        for (const auto& entry : names){
+            Strategy candidate = base;
+            candidate.*axis = entry.first;
+            candidates.push_back(candidate);
+        }
+    }
+
+    Strategy TuneStrategy(Solver& solver, Particles& particles, int frames){
+        // measured once per strategy, sweeps revisit the current best on every axis
+        std::map<std::string, double> measured;
+        auto measure = [&](const Strategy& strategy){
+            std::string label = Describe(strategy);
+            auto it = measured.find(label);
+            if (it != measured.end()) return it->second;
+
+            bench::Result result = bench::Run(solver, particles, label, [&](Solver& s){ ApplyStrategy(s, strategy); }, frames);
+            measured[label] = result.gpuMs;
+            std::cout << std::left << std::setw(36) << label << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(10) << result.gpuMs << " ms/frame" << std::setw(10) << std::setprecision(1)
+                      << particles.count() / (1e3 * result.gpuMs) << " Mparticles/s" << std::endl;
+            return result.gpuMs;
+        };
+
+        Strategy best{solver.GetFusedKernels(), solver.GetSortAlgorithm(), solver.GetNeighbourTraversal(),
+                      solver.GetCellKeys(), solver.GetSearchStencil()};
+        double bestMs = measure(best);
+
+        for (int round = 0; round < MAX_ROUNDS; round++){
+            bool changed = false;
+            for (int axis = 0; axis < 5; axis++){
+                std::vector<Strategy> candidates;
+                switch (axis){
+                    case 0: vary(best, &Strategy::fusedKernels, FUSED_NAMES, candidates); break;
+                    case 1: vary(best, &Strategy::sortAlgorithm, SORT_NAMES, candidates); break;
+                    case 2: vary(best, &Strategy::traversal, TRAVERSAL_NAMES, candidates); break;
+                    case 3: vary(best, &Strategy::cellKeys, KEY_NAMES, candidates); break;
+                    case 4: vary(best, &Strategy::searchStencil, STENCIL_NAMES, candidates); break;
+                }
+                for (const auto& candidate : candidates){
+                    double ms = measure(candidate);
+                    if (ms >= bestMs * (1.0 - MIN_GAIN)) continue;
+                    best = candidate;
+                    bestMs = ms;
+                    changed = true;
+                }
+            }
+            if (!changed) break;
+        }
+
+        std::cout << "Best: " << Describe(best) << ", " << std::setprecision(3) << bestMs << " ms/frame" << std::endl;
+        ApplyStrategy(solver, best);
+        return best;
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include "particles.hpp"
+#include "solver.hpp"
+
+namespace tune{
+    /**
+     * @brief Solver configuration axes the strategy tuner explores
+     */
+    struct Strategy
+    {
+        bool fusedKernels = true;
+        SortAlgorithm sortAlgorithm = SortAlgorithm::BITONIC;
+        NeighbourTraversal traversal = NeighbourTraversal::GLOBAL;
+        CellKeys cellKeys = CellKeys::ROW_MAJOR;
+        SearchStencil searchStencil = SearchStencil::CELLS_3X3;
+    };
+
+    /**
+     * @brief Renderer and driver version, the tuned sizes are only reused on the same pair
+     */
+    std::string DeviceKey();
+
+    /**
+     * @brief Apply the local sizes stored for this device
+     * 
+     * @return false when the file holds none for this device
+     */
+    bool LoadLocalSizes(Solver& solver, const std::string& path);
+
+    /**
+     * @brief Store the solver's local sizes for this device, keeping the other devices' entries
+     */
+    void SaveLocalSizes(const Solver& solver, const std::string& path);
+
+    /**
+     * @brief Time every tunable kernel at each power of two local size and keep the fastest
+     * 
+     * Runs the scene from its initial state for every candidate. Kernels whose pass does not run
+     * in the solver's current configuration keep their size, and those the current traversal
+     * runs at a fixed size are timed under the global traversal instead.
+     * 
+     * @param frames Number of measured frames per candidate
+     */
+    void TuneLocalSizes(Solver& solver, Particles& particles, int frames);
+
+    /**
+     * @brief Short description such as "fused radix cells row 3x3"
+     */
+    std::string Describe(const Strategy& strategy);
+
+    /**
+     * @brief Set every axis of the strategy on the solver
+     */
+    void ApplyStrategy(Solver& solver, const Strategy& strategy);
+
+    /**
+     * @brief Overwrite the fields the file sets, lines are "axis=value"
+     * 
+     * @return false when the file does not exist
+     */
+    bool LoadStrategy(const std::string& path, Strategy& strategy);
+
+    /**
+     * @brief Write the strategy with the device and particle count it was tuned for as comments
+     */
+    void SaveStrategy(const Strategy& strategy, const std::string& path, size_t numParticles);
+
+    /**
+     * @brief Search the strategy axes for the lowest GPU time per frame on the current scene
+     * 
+     * Coordinate descent from the solver's current strategy: every axis is swept with the others
+     * held, keeping any value that wins by more than the noise margin, until a round changes
+     * nothing. Leaves the solver in the best strategy found.
+     * 
+     * @param frames Number of measured frames per candidate
+     */
+    Strategy TuneStrategy(Solver& solver, Particles& particles, int frames);
+}
@@ -0,0 +1,94 @@
+#include "benchmark.hpp"
+#include <chrono>
+#include <iomanip>
+
+namespace bench{
+    static const int WARMUP_FRAMES = 10;
+
+    Result Run(Solver& solver, Particles& particles, const std::string& label,
+               const std::function<void(Solver&)>& configure, int frames){
+        PassGraph& passGraph = solver.GetPassGraph();
+        bool profiling = passGraph.IsProfiling();
+
+        configure(solver);
+        particles.reset();
+        passGraph.SetProfiling(true);
+
+        Result result{label, {}, 0.0, 0.0, {}};
+        for (int i = 0; i < WARMUP_FRAMES; i++) solver.Update();
+        glFinish();
+
+        // timings lag two frames behind, so run two more frames than are counted, and a frame the
+        // GPU had not finished when its queries were recycled is left out of the average
+        int timed = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames + 2; i++){
+            size_t resolved = passGraph.GetResolvedFrames();
+            solver.Update();
+            if (i < 2 || passGraph.GetResolvedFrames() == resolved) continue;
+            timed++;
+            for (const auto& timing : passGraph.GetTimings()){
+                auto it = std::find_if(result.passes.begin(), result.passes.end(),
+                    [&](const PassTiming& t){ return t.name == timing.name; });
+                if (it == result.passes.end()) result.passes.push_back(timing);
+                else it->ms += timing.ms;
+            }
+        }
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+
+        for (auto& pass : result.passes){
+            pass.ms /= timed;
+            result.gpuMs += pass.ms;
+        }
+        result.wallMs = std::chrono::duration<double, std::milli>(end - start).count() / (frames + 2);
+
+        passGraph.SetProfiling(profiling);
+        return result;
+    }
+
+    void Print(const std::vector<Result>& results){
+        std::vector<std::string> names;
+        for (const auto& result : results)
+            for (const auto& pass : result.passes)
+                if (std::find(names.begin(), names.end(), pass.name) == names.end()) names.push_back(pass.name);
+
+        std::cout << std::left << std::setw(28) << "ms/frame";
+        for (const auto& result : results) std::cout << std::right << std::setw(16) << result.label;
+        std::cout << "\n" << std::fixed << std::setprecision(3);
+
+        for (const auto& name : names){
+            std::cout << std::left << std::setw(28) << name;
+            for (const auto& result : results){
+                auto it = std::find_if(result.passes.begin(), result.passes.end(),
+                    [&](const PassTiming& t){ return t.name == name; });
+                if (it == result.passes.end()) std::cout << std::right << std::setw(16) << "-";
+                else std::cout << std::right << std::setw(16) << it->ms;
+            }
+            std::cout << "\n";
+        }
+
+        std::cout << std::left << std::setw(28) << "GPU total";
+        for (const auto& result : results) std::cout << std::right << std::setw(16) << result.gpuMs;
+        std::cout << "\n" << std::left << std::setw(28) << "Wall clock";
+        for (const auto& result : results) std::cout << std::right << std::setw(16) << result.wallMs;
+        std::cout << "\n";
+
+        std::vector<std::string> metrics;
+        for (const auto& result : results)
+            for (const auto& metric : result.metrics)
+                if (std::find(metrics.begin(), metrics.end(), metric.name) == metrics.end()) metrics.push_back(metric.name);
+
+        for (const auto& name : metrics){
+            std::cout << std::left << std::setw(28) << name;
+            for (const auto& result : results){
+                auto it = std::find_if(result.metrics.begin(), result.metrics.end(),
+                    [&](const Metric& m){ return m.name == name; });
+                if (it == result.metrics.end()) std::cout << std::right << std::setw(16) << "-";
+                else std::cout << std::right << std::setw(16) << it->value;
+            }
+            std::cout << "\n";
+        }
+        std::cout << std::flush;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include "particles.hpp"
+#include "solver.hpp"
+
+namespace bench{
+    /**
+     * @brief Extra row printed under the timings
+     */
+    struct Metric
+    {
+        std::string name;
+        double value;
+    };
+
+    /**
+     * @brief Averaged GPU timings of one solver configuration
+     */
+    struct Result
+    {
+        std::string label;
+        std::vector<PassTiming> passes; // ms per frame
+        double gpuMs;                   // sum of the passes, ms per frame
+        double wallMs;                  // wall clock including CPU submission, ms per frame
+        std::vector<Metric> metrics;    // filled in by the caller, e.g. cache lines touched
+    };
+
+    /**
+     * @brief Run the scene from its initial state and time every pass
+     * 
+     * @param configure Applies the configuration under test to the solver
+     * @param frames Number of measured frames, after a short warm-up. The pass times average the
+     *               frames whose timestamps were ready when read, the wall clock all of them.
+     */
+    Result Run(Solver& solver, Particles& particles, const std::string& label,
+               const std::function<void(Solver&)>& configure, int frames);
+
+    /**
+     * @brief Print the results side by side, one column per configuration
+     */
+    void Print(const std::vector<Result>& results);
+}
@@ -0,0 +1,299 @@
+#include "cpu_kernels.hpp"
+#include "cpu_reference.hpp"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace cpu{
+
+// one pair of the kernels below, also the tail of the vector loops
+static inline void densityPair(const Fields& p, const PairConstants& c, float xi, float yi, uint32_t j, float& a3, float& a4){
+    float dx = p.x[j] - xi;
+    float dy = p.y[j] - yi;
+    float a;
+    if (!FluidWeight(c, dx * dx + dy * dy, a)) return;
+
+    float cube = a * a * a;
+    a3 += cube;
+    a4 += cube * a;
+}
+
+static inline void correctionPair(const Fields& p, const PairConstants& c, uint32_t i, uint32_t j, float& sx, float& sy){
+    float dx = p.x[j] - p.x[i];
+    float dy = p.y[j] - p.y[i];
+    float r2 = dx * dx + dy * dy;
+    if (r2 > c.h2 || r2 < c.eta2) return;
+
+    float coefficient = FluidCorrection(c, dx, dy, r2, p.vx[j] - p.vx[i], p.vy[j] - p.vy[i],
+                                        p.pressure[i] + p.pressure[j], p.pv[i] * p.pv[j]);
+    sx += coefficient * dx;
+    sy += coefficient * dy;
+}
+
+static void densityScalar(const Fields& p, const PairConstants& c, uint32_t i0, uint32_t i1,
+                          uint32_t j0, uint32_t j1, float* a3, float* a4){
+    for (uint32_t i = i0; i < i1; i++){
+        float s3 = 0.0f, s4 = 0.0f;
+        for (uint32_t j = j0; j < j1; j++) densityPair(p, c, p.x[i], p.y[i], j, s3, s4);
+        a3[i - i0] += s3;
+        a4[i - i0] += s4;
+    }
+}
+
+static void correctionScalar(const Fields& p, const PairConstants& c, uint32_t i0, uint32_t i1,
+                             uint32_t j0, uint32_t j1, float* dx, float* dy){
+    for (uint32_t i = i0; i < i1; i++){
+        float sx = 0.0f, sy = 0.0f;
+        for (uint32_t j = j0; j < j1; j++) correctionPair(p, c, i, j, sx, sy);
+        dx[i - i0] += sx;
+        dy[i - i0] += sy;
+    }
+}
+
+#ifdef CPU_KERNELS_X86
+// built for their instruction set only, Kernels() hands them out once DetectSimd() found it
+
+__attribute__((target("avx2,fma")))
+static inline float sumAvx2(__m256 v){
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_movehdup_ps(half));
+    return _mm_cvtss_f32(half);
+}
+
+__attribute__((target("avx2,fma")))
+static void densityAvx2(const Fields& p, const PairConstants& c, uint32_t i0, uint32_t i1,
+                        uint32_t j0, uint32_t j1, float* a3, float* a4){
+    const __m256 h2 = _mm256_set1_ps(c.h2);
+    const __m256 eta2 = _mm256_set1_ps(c.eta2);
+    const __m256 invH = _mm256_set1_ps(1.0f / c.h);
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    for (uint32_t i = i0; i < i1; i++){
+        const __m256 xi = _mm256_set1_ps(p.x[i]);
+        const __m256 yi = _mm256_set1_ps(p.y[i]);
+        __m256 s3 = _mm256_setzero_ps();
+        __m256 s4 = _mm256_setzero_ps();
+
+        uint32_t j = j0;
+        for (; j + 8 <= j1; j += 8){
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(p.x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(p.y + j), yi);
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+            __m256 inside = _mm256_and_ps(_mm256_cmp_ps(r2, h2, _CMP_LE_OQ), _mm256_cmp_ps(r2, eta2, _CMP_GE_OQ));
+
+            // lanes outside h contribute a = 0
+            __m256 a = _mm256_and_ps(_mm256_fnmadd_ps(_mm256_sqrt_ps(r2), invH, one), inside);
+            __m256 cube = _mm256_mul_ps(_mm256_mul_ps(a, a), a);
+            s3 = _mm256_add_ps(s3, cube);
+            s4 = _mm256_fmadd_ps(cube, a, s4);
+        }
+
+        float t3 = sumAvx2(s3), t4 = sumAvx2(s4);
+        for (; j < j1; j++) densityPair(p, c, p.x[i], p.y[i], j, t3, t4);
+        a3[i - i0] += t3;
+        a4[i - i0] += t4;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void correctionAvx2(const Fields& p, const PairConstants& c, uint32_t i0, uint32_t i1,
+                           uint32_t j0, uint32_t j1, float* dx, float* dy){
+    const __m256 h2 = _mm256_set1_ps(c.h2);
+    const __m256 eta2 = _mm256_set1_ps(c.eta2);
+    const __m256 invH = _mm256_set1_ps(1.0f / c.h);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 halfDt2 = _mm256_set1_ps(0.5f * c.dt2);
+    const __m256 kernelNorm = _mm256_set1_ps(c.kernelNorm);
+    const __m256 kernelFactor = _mm256_set1_ps(c.kernelFactor);
+    const __m256 mass = _mm256_set1_ps(c.mass);
+    const __m256 tension = _mm256_set1_ps(c.surfaceTension * c.kernelFactor);
+    const __m256 linearVisc = _mm256_set1_ps(c.linearVisc);
+    const __m256 quadVisc = _mm256_set1_ps(c.quadVisc);
+
+    for (uint32_t i = i0; i < i1; i++){
+        const __m256 xi = _mm256_set1_ps(p.x[i]);
+        const __m256 yi = _mm256_set1_ps(p.y[i]);
+        const __m256 vxi = _mm256_set1_ps(p.vx[i]);
+        const __m256 vyi = _mm256_set1_ps(p.vy[i]);
+        const __m256 pressure = _mm256_set1_ps(p.pressure[i]);
+        const __m256 pv = _mm256_set1_ps(p.pv[i]);
+        __m256 sx = _mm256_setzero_ps();
+        __m256 sy = _mm256_setzero_ps();
+
+        uint32_t j = j0;
+        for (; j + 8 <= j1; j += 8){
+            __m256 ex = _mm256_sub_ps(_mm256_loadu_ps(p.x + j), xi);
+            __m256 ey = _mm256_sub_ps(_mm256_loadu_ps(p.y + j), yi);
+            __m256 r2 = _mm256_fmadd_ps(ex, ex, _mm256_mul_ps(ey, ey));
+            __m256 inside = _mm256_and_ps(_mm256_cmp_ps(r2, h2, _CMP_LE_OQ), _mm256_cmp_ps(r2, eta2, _CMP_GE_OQ));
+
+            __m256 r = _mm256_sqrt_ps(r2);
+            __m256 a = _mm256_fnmadd_ps(r, invH, one);
+            __m256 a2 = _mm256_mul_ps(a, a);
+            __m256 a3 = _mm256_mul_ps(a2, a);
+
+            // pressure and surface tension
+            __m256 pvTerm = _mm256_mul_ps(_mm256_mul_ps(pv, _mm256_loadu_ps(p.pv + j)), _mm256_mul_ps(a3, kernelNorm));
+            __m256 pressureTerm = _mm256_mul_ps(_mm256_add_ps(pressure, _mm256_loadu_ps(p.pressure + j)), _mm256_mul_ps(a2, kernelFactor));
+            __m256 d = _mm256_mul_ps(halfDt2, _mm256_add_ps(pvTerm, pressureTerm));
+            __m256 coefficient = _mm256_fmsub_ps(tension, a2, _mm256_div_ps(d, _mm256_mul_ps(r, mass)));
+
+            // viscosity of the approaching pairs
+            __m256 dvx = _mm256_sub_ps(_mm256_loadu_ps(p.vx + j), vxi);
+            __m256 dvy = _mm256_sub_ps(_mm256_loadu_ps(p.vy + j), vyi);
+            __m256 u = _mm256_fmadd_ps(dvx, ex, _mm256_mul_ps(dvy, ey));
+            __m256 approaching = _mm256_cmp_ps(u, zero, _CMP_GT_OQ);
+            u = _mm256_div_ps(u, r);
+            __m256 impulse = _mm256_mul_ps(_mm256_mul_ps(halfDt2, a), _mm256_fmadd_ps(quadVisc, _mm256_mul_ps(u, u), _mm256_mul_ps(linearVisc, u)));
+            coefficient = _mm256_sub_ps(coefficient, _mm256_and_ps(impulse, approaching));
+
+            // clearing the bits also drops the inf and nan of the pairs at r = 0
+            coefficient = _mm256_and_ps(coefficient, inside);
+            sx = _mm256_fmadd_ps(coefficient, ex, sx);
+            sy = _mm256_fmadd_ps(coefficient, ey, sy);
+        }
+
+        float tx = sumAvx2(sx), ty = sumAvx2(sy);
+        for (; j < j1; j++) correctionPair(p, c, i, j, tx, ty);
+        dx[i - i0] += tx;
+        dy[i - i0] += ty;
+    }
+}
+
+// GCC 12 flags the deliberately undefined pass-through operands of its own AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static void densityAvx512(const Fields& p, const PairConstants& c, uint32_t i0, uint32_t i1,
+                          uint32_t j0, uint32_t j1, float* a3, float* a4){
+    const __m512 h2 = _mm512_set1_ps(c.h2);
+    const __m512 eta2 = _mm512_set1_ps(c.eta2);
+    const __m512 invH = _mm512_set1_ps(1.0f / c.h);
+    const __m512 one = _mm512_set1_ps(1.0f);
+
+    for (uint32_t i = i0; i < i1; i++){
+        const __m512 xi = _mm512_set1_ps(p.x[i]);
+        const __m512 yi = _mm512_set1_ps(p.y[i]);
+        __m512 s3 = _mm512_setzero_ps();
+        __m512 s4 = _mm512_setzero_ps();
+
+        uint32_t j = j0;
+        for (; j + 16 <= j1; j += 16){
+            __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(p.x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(p.y + j), yi);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+            __mmask16 inside = _mm512_cmp_ps_mask(r2, h2, _CMP_LE_OQ) & _mm512_cmp_ps_mask(r2, eta2, _CMP_GE_OQ);
+
+            __m512 a = _mm512_fnmadd_ps(_mm512_sqrt_ps(r2), invH, one);
+            __m512 cube = _mm512_mul_ps(_mm512_mul_ps(a, a), a);
+            s3 = _mm512_mask_add_ps(s3, inside, s3, cube);
+            s4 = _mm512_mask3_fmadd_ps(cube, a, s4, inside);
+        }
+
+        float t3 = _mm512_reduce_add_ps(s3), t4 = _mm512_reduce_add_ps(s4);
+        for (; j < j1; j++) densityPair(p, c, p.x[i], p.y[i], j, t3, t4);
+        a3[i - i0] += t3;
+        a4[i - i0] += t4;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void correctionAvx512(const Fields& p, const PairConstants& c, uint32_t i0, uint32_t i1,
+                             uint32_t j0, uint32_t j1, float* dx, float* dy){
+    const __m512 h2 = _mm512_set1_ps(c.h2);
+    const __m512 eta2 = _mm512_set1_ps(c.eta2);
+    const __m512 invH = _mm512_set1_ps(1.0f / c.h);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 halfDt2 = _mm512_set1_ps(0.5f * c.dt2);
+    const __m512 kernelNorm = _mm512_set1_ps(c.kernelNorm);
+    const __m512 kernelFactor = _mm512_set1_ps(c.kernelFactor);
+    const __m512 mass = _mm512_set1_ps(c.mass);
+    const __m512 tension = _mm512_set1_ps(c.surfaceTension * c.kernelFactor);
+    const __m512 linearVisc = _mm512_set1_ps(c.linearVisc);
+    const __m512 quadVisc = _mm512_set1_ps(c.quadVisc);
+
+    for (uint32_t i = i0; i < i1; i++){
+        const __m512 xi = _mm512_set1_ps(p.x[i]);
+        const __m512 yi = _mm512_set1_ps(p.y[i]);
+        const __m512 vxi = _mm512_set1_ps(p.vx[i]);
+        const __m512 vyi = _mm512_set1_ps(p.vy[i]);
+        const __m512 pressure = _mm512_set1_ps(p.pressure[i]);
+        const __m512 pv = _mm512_set1_ps(p.pv[i]);
+        __m512 sx = _mm512_setzero_ps();
+        __m512 sy = _mm512_setzero_ps();
+
+        uint32_t j = j0;
+        for (; j + 16 <= j1; j += 16){
+            __m512 ex = _mm512_sub_ps(_mm512_loadu_ps(p.x + j), xi);
+            __m512 ey = _mm512_sub_ps(_mm512_loadu_ps(p.y + j), yi);
+            __m512 r2 = _mm512_fmadd_ps(ex, ex, _mm512_mul_ps(ey, ey));
+            __mmask16 inside = _mm512_cmp_ps_mask(r2, h2, _CMP_LE_OQ) & _mm512_cmp_ps_mask(r2, eta2, _CMP_GE_OQ);
+
+            __m512 r = _mm512_sqrt_ps(r2);
+            __m512 a = _mm512_fnmadd_ps(r, invH, one);
+            __m512 a2 = _mm512_mul_ps(a, a);
+            __m512 a3 = _mm512_mul_ps(a2, a);
+
+            // pressure and surface tension
+            __m512 pvTerm = _mm512_mul_ps(_mm512_mul_ps(pv, _mm512_loadu_ps(p.pv + j)), _mm512_mul_ps(a3, kernelNorm));
+            __m512 pressureTerm = _mm512_mul_ps(_mm512_add_ps(pressure, _mm512_loadu_ps(p.pressure + j)), _mm512_mul_ps(a2, kernelFactor));
+            __m512 d = _mm512_mul_ps(halfDt2, _mm512_add_ps(pvTerm, pressureTerm));
+            __m512 coefficient = _mm512_fmsub_ps(tension, a2, _mm512_div_ps(d, _mm512_mul_ps(r, mass)));
+
+            // viscosity of the approaching pairs
+            __m512 dvx = _mm512_sub_ps(_mm512_loadu_ps(p.vx + j), vxi);
+            __m512 dvy = _mm512_sub_ps(_mm512_loadu_ps(p.vy + j), vyi);
+            __m512 u = _mm512_fmadd_ps(dvx, ex, _mm512_mul_ps(dvy, ey));
+            __mmask16 approaching = _mm512_cmp_ps_mask(u, zero, _CMP_GT_OQ);
+            u = _mm512_div_ps(u, r);
+            __m512 impulse = _mm512_mul_ps(_mm512_mul_ps(halfDt2, a), _mm512_fmadd_ps(quadVisc, _mm512_mul_ps(u, u), _mm512_mul_ps(linearVisc, u)));
+            coefficient = _mm512_mask_sub_ps(coefficient, approaching, coefficient, impulse);
+
+            sx = _mm512_mask3_fmadd_ps(coefficient, ex, sx, inside);
+            sy = _mm512_mask3_fmadd_ps(coefficient, ey, sy, inside);
+        }
+
+        float tx = _mm512_reduce_add_ps(sx), ty = _mm512_reduce_add_ps(sy);
+        for (; j < j1; j++) correctionPair(p, c, i, j, tx, ty);
+        dx[i - i0] += tx;
+        dy[i - i0] += ty;
+    }
+}
+#pragma GCC diagnostic pop
+#endif
+
+Simd DetectSimd(){
+#ifdef CPU_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return Simd::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Simd::AVX2;
+#endif
+    return Simd::SCALAR;
+}
+
+const char* SimdName(Simd simd){
+    switch (simd){
+        case Simd::AVX2: return "avx2";
+        case Simd::AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+TileKernels Kernels(Simd simd){
+#ifdef CPU_KERNELS_X86
+    if (simd == Simd::AVX512) return {densityAvx512, correctionAvx512};
+    if (simd == Simd::AVX2) return {densityAvx2, correctionAvx2};
+#else
+    (void)simd;
+#endif
+    return {densityScalar, correctionScalar};
+}
+
+}
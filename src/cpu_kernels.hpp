@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cpu{
+    /**
+     * @brief Instruction sets the tile kernels are built for
+     */
+    enum class Simd
+    {
+        SCALAR,
+        AVX2,   // 8 lanes, with FMA
+        AVX512  // 16 lanes, AVX-512F
+    };
+
+    /**
+     * @brief Widest instruction set the CPU and OS support, from CPUID
+     */
+    Simd DetectSimd();
+
+    const char* SimdName(Simd simd);
+
+    /**
+     * @brief Fluid particles in cell order, one array per field
+     */
+    struct Fields
+    {
+        const float* x;
+        const float* y;
+        const float* vx;
+        const float* vy;
+        const float* pressure;
+        const float* pv;
+    };
+
+    /**
+     * @brief Constants of the pair terms, the solver's values
+     */
+    struct PairConstants
+    {
+        float h;
+        float h2;
+        float eta2;             // pairs closer than this are the particle itself
+        float dt;
+        float dt2;
+        float mass;
+        float boundaryMass;
+        float kernelFactor;
+        float kernelNorm;
+        float surfaceTension;
+        float linearVisc;
+        float quadVisc;
+    };
+
+    /**
+     * @brief Density sums of the particles [i0, i1) over the candidates [j0, j1)
+     *
+     * Adds the sum of a^3 and of a^4, a = 1 - r / h, over the pairs within h to a3 and a4,
+     * indexed from i0. The caller scales them by the mass and kernel constants.
+     */
+    using DensityTile = void (*)(const Fields& p, const PairConstants& c, uint32_t i0, uint32_t i1,
+                                 uint32_t j0, uint32_t j1, float* a3, float* a4);
+
+    /**
+     * @brief Pressure, surface tension and viscosity displacement of the particles [i0, i1) from
+     *        the candidates [j0, j1), added to dx and dy indexed from i0
+     */
+    using CorrectionTile = void (*)(const Fields& p, const PairConstants& c, uint32_t i0, uint32_t i1,
+                                    uint32_t j0, uint32_t j1, float* dx, float* dy);
+
+    struct TileKernels
+    {
+        DensityTile density;
+        CorrectionTile correction;
+    };
+
+    /**
+     * @brief Tile kernels built for simd, which the CPU must support
+     */
+    TileKernels Kernels(Simd simd);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include "cpu_kernels.hpp"
+
+// Scalar terms of the solver kernels, shared by every CPU mirror of the GPU math: the Validator's
+// brute-force reference, CpuSolver's wall loops and the tails of its tile kernels.
+namespace cpu{
+    // same as the kernels, pairs closer than this are the particle itself
+    constexpr float ETA2 = 1e-5f * 1e-5f;
+
+    /**
+     * @brief The box common/walls.glsl keeps the particles in
+     */
+    struct Walls
+    {
+        float width;
+        float height;
+        float radius;   // particles closer to a wall than this are kicked back
+        float dt;
+    };
+
+    /**
+     * @brief a = 1 - r / h of a fluid pair, false outside h and for the particle itself
+     */
+    inline bool FluidWeight(const PairConstants& c, float r2, float& a){
+        if (r2 > c.h2 || r2 < c.eta2) return false;
+        a = 1.0f - std::sqrt(r2) / c.h;
+        return true;
+    }
+
+    /**
+     * @brief Displacement of particle i per unit of the offset (dx, dy) to a fluid neighbour
+     *
+     * Pressure, surface tension and viscosity, the caller adds coefficient * (dx, dy).
+     */
+    inline float FluidCorrection(const PairConstants& c, float dx, float dy, float r2, float dvx, float dvy,
+                                 float pressureSum, float pvProduct){
+        float r = std::sqrt(r2);
+        float a = 1.0f - r / c.h;
+        float d = c.dt2 * (pvProduct * a * a * a * c.kernelNorm + pressureSum * a * a * c.kernelFactor) / 2.0f;
+        float coefficient = -d / (r * c.mass) + c.surfaceTension * a * a * c.kernelFactor;
+
+        float u = dvx * dx + dvy * dy;
+        if (u > 0.0f){
+            u /= r;
+            float impulse = 0.5f * c.dt * a * (c.linearVisc * u + c.quadVisc * u * u);
+            coefficient -= impulse * c.dt;
+        }
+        return coefficient;
+    }
+
+    /**
+     * @brief Adds a^3 and a^4 of a wall particle within h, the particle itself is never a wall
+     */
+    inline void WallDensity(const PairConstants& c, float r2, float& a3, float& a4){
+        if (r2 > c.h2) return;
+        float a = 1.0f - std::sqrt(r2) / c.h;
+        a3 += a * a * a;
+        a4 += a * a * a * a;
+    }
+
+    /**
+     * @brief Displacement of a particle per unit of the offset to a wall particle, 0 outside h
+     *
+     * Walls mirror the particle's pressure and only ever push it away.
+     */
+    inline float WallCorrection(const PairConstants& c, float r2, float pressure, float pv){
+        if (r2 > c.h2 || r2 < c.eta2) return 0.0f;
+
+        float wallPressure = std::max(pressure, 0.0f);
+        float r = std::sqrt(r2);
+        float a = 1.0f - r / c.h;
+        float d = c.dt2 * (pv * pv * a * a * a * c.kernelNorm + 2.0f * wallPressure * a * a * c.kernelFactor) / 2.0f;
+        return -d * c.boundaryMass / (r * c.mass);
+    }
+
+    /**
+     * @brief Push the velocity of a particle closer than the radius to a wall back inside
+     */
+    inline void WallKick(const Walls& walls, float px, float py, float& vx, float& vy){
+        const float planes[4][3] = {{-1.0f, 0.0f, -walls.width}, {0.0f, -1.0f, -walls.height}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}};
+
+        for (const auto& plane : planes){
+            float distance = std::max(px * plane[0] + py * plane[1] - plane[2], 0.0f);
+            if (distance < walls.radius){
+                vx += (walls.radius - distance) * plane[0] / walls.dt;
+                vy += (walls.radius - distance) * plane[1] / walls.dt;
+            }
+        }
+    }
+}
@@ -0,0 +1,210 @@
+#include "cpu_solver.hpp"
+#include "cpu_reference.hpp"
+#include <cmath>
+#include <algorithm>
+
+CpuSolver::CpuSolver(const Solver& solver, const Particles& particles)
+    : initialPositions(particles.positions), constants(solver.CpuConstants()), walls(solver.CpuWalls()){
+    // one smoothing length per cell, so a particle's neighbours are in the 3x3 cells around it
+    cellSize = Solver::smoothing_length;
+    gridWidth = (int)std::ceil(solver.VIEWPORT_WIDTH / cellSize);
+    gridHeight = (int)std::ceil(solver.VIEWPORT_HEIGHT / cellSize);
+
+    gravity = solver.GRAVITY;
+    restDensity = solver.REST_DENSITY;
+
+    wallX.resize(particles.num_boundary_particles);
+    wallY.resize(particles.num_boundary_particles);
+    for (size_t b = 0; b < particles.num_boundary_particles; b++){
+        wallX[b] = particles.boundary_positions[2 * b];
+        wallY[b] = particles.boundary_positions[2 * b + 1];
+    }
+    BinWalls();
+
+    SetSimd(cpu::DetectSimd());
+    Reset();
+}
+
+void CpuSolver::SetSimd(cpu::Simd _simd){
+    simd = std::min(_simd, cpu::DetectSimd());
+    kernels = cpu::Kernels(simd);
+}
+
+cpu::Simd CpuSolver::GetSimd() const{
+    return simd;
+}
+
+void CpuSolver::Reset(){
+    size_t n = initialPositions.size() / 2;
+    x.resize(n);
+    y.resize(n);
+    ids.resize(n);
+    for (size_t i = 0; i < n; i++){
+        x[i] = initialPositions[2 * i];
+        y[i] = initialPositions[2 * i + 1];
+        ids[i] = (uint32_t)i;
+    }
+    vx.assign(n, 0.0f);
+    vy.assign(n, 0.0f);
+    previousX = x;
+    previousY = y;
+    pressure.assign(n, 0.0f);
+    pv.assign(n, 0.0f);
+}
+
+int CpuSolver::CellIndex(float px, float py) const{
+    // clamped like GetCellPos, so the cells around any particle are inside the grid
+    int cx = std::clamp((int)(px / cellSize), 1, gridWidth - 2);
+    int cy = std::clamp((int)(py / cellSize), 1, gridHeight - 2);
+    return cx + cy * gridWidth;
+}
+
+template <typename T>
+void CpuSolver::Permute(std::vector<T>& values){
+    std::vector<T> sorted(values.size());
+    for (size_t slot = 0; slot < order.size(); slot++) sorted[slot] = values[order[slot]];
+    values.swap(sorted);
+}
+
+void CpuSolver::BinWalls(){
+    std::vector<uint32_t> wallCells(wallX.size());
+    for (size_t b = 0; b < wallX.size(); b++) wallCells[b] = CellIndex(wallX[b], wallY[b]);
+
+    std::vector<uint32_t> wallOrder(wallX.size());
+    for (size_t b = 0; b < wallOrder.size(); b++) wallOrder[b] = (uint32_t)b;
+    std::stable_sort(wallOrder.begin(), wallOrder.end(), [&](uint32_t a, uint32_t b){ return wallCells[a] < wallCells[b]; });
+
+    std::vector<float> sortedX(wallX.size()), sortedY(wallY.size());
+    wallStart.assign(gridWidth * gridHeight + 1, 0);
+    for (size_t slot = 0; slot < wallOrder.size(); slot++){
+        sortedX[slot] = wallX[wallOrder[slot]];
+        sortedY[slot] = wallY[wallOrder[slot]];
+        wallStart[wallCells[wallOrder[slot]] + 1]++;
+    }
+    for (size_t cell = 0; cell + 1 < wallStart.size(); cell++) wallStart[cell + 1] += wallStart[cell];
+    wallX.swap(sortedX);
+    wallY.swap(sortedY);
+}
+
+void CpuSolver::Integrate(){
+    for (size_t i = 0; i < x.size(); i++){
+        previousX[i] = x[i];
+        previousY[i] = y[i];
+        vx[i] += gravity.x * Solver::DT;
+        vy[i] += gravity.y * Solver::DT;
+        x[i] += vx[i] * Solver::DT;
+        y[i] += vy[i] * Solver::DT;
+    }
+}
+
+void CpuSolver::Bin(){
+    // counting sort by cell, stable so a particle only moves when it changed cell
+    size_t n = x.size();
+    cells.resize(n);
+    cellStart.assign(gridWidth * gridHeight + 1, 0);
+    for (size_t i = 0; i < n; i++){
+        cells[i] = CellIndex(x[i], y[i]);
+        cellStart[cells[i] + 1]++;
+    }
+    for (size_t cell = 0; cell + 1 < cellStart.size(); cell++) cellStart[cell + 1] += cellStart[cell];
+
+    std::vector<uint32_t> next(cellStart.begin(), cellStart.end() - 1);
+    order.resize(n);
+    for (size_t i = 0; i < n; i++) order[next[cells[i]]++] = (uint32_t)i;
+
+    Permute(x);
+    Permute(y);
+    Permute(vx);
+    Permute(vy);
+    Permute(previousX);
+    Permute(previousY);
+    Permute(ids);
+}
+
+void CpuSolver::PressureSolve(){
+    cpu::Fields fields = {x.data(), y.data(), vx.data(), vy.data(), pressure.data(), pv.data()};
+    sum3.assign(x.size(), 0.0f);
+    sum4.assign(x.size(), 0.0f);
+
+    for (int cell = 0; cell < gridWidth * gridHeight; cell++){
+        uint32_t i0 = cellStart[cell], i1 = cellStart[cell + 1];
+        if (i0 == i1) continue;
+
+        // the three cells of a row are contiguous, the tile stays in cache over all three rows
+        for (int row = -1; row <= 1; row++){
+            int centre = cell + row * gridWidth;
+            kernels.density(fields, constants, i0, i1, cellStart[centre - 1], cellStart[centre + 2], &sum3[i0], &sum4[i0]);
+        }
+
+        for (uint32_t i = i0; i < i1; i++){
+            float wall3 = 0.0f, wall4 = 0.0f;
+            for (int row = -1; row <= 1; row++){
+                int centre = cell + row * gridWidth;
+                for (uint32_t b = wallStart[centre - 1]; b < wallStart[centre + 2]; b++){
+                    float dx = wallX[b] - x[i], dy = wallY[b] - y[i];
+                    cpu::WallDensity(constants, dx * dx + dy * dy, wall3, wall4);
+                }
+            }
+
+            float density = Solver::KERNEL_FACTOR * (constants.mass * sum3[i] + constants.boundaryMass * wall3);
+            float dv = Solver::KERNEL_NORM * (constants.mass * sum4[i] + constants.boundaryMass * wall4);
+            pressure[i] = Solver::STIFFNESS * (density - restDensity * constants.mass);
+            pv[i] = Solver::STIFF_APPROX * dv;
+        }
+    }
+}
+
+void CpuSolver::ProjectionCorrection(){
+    // the kernels read the state before the pass, the corrections are applied after every tile ran
+    cpu::Fields fields = {x.data(), y.data(), vx.data(), vy.data(), pressure.data(), pv.data()};
+    correctionX.assign(x.size(), 0.0f);
+    correctionY.assign(x.size(), 0.0f);
+
+    for (int cell = 0; cell < gridWidth * gridHeight; cell++){
+        uint32_t i0 = cellStart[cell], i1 = cellStart[cell + 1];
+        if (i0 == i1) continue;
+
+        for (int row = -1; row <= 1; row++){
+            int centre = cell + row * gridWidth;
+            kernels.correction(fields, constants, i0, i1, cellStart[centre - 1], cellStart[centre + 2], &correctionX[i0], &correctionY[i0]);
+        }
+
+        for (uint32_t i = i0; i < i1; i++){
+            for (int row = -1; row <= 1; row++){
+                int centre = cell + row * gridWidth;
+                for (uint32_t b = wallStart[centre - 1]; b < wallStart[centre + 2]; b++){
+                    float dx = wallX[b] - x[i], dy = wallY[b] - y[i];
+                    float coefficient = cpu::WallCorrection(constants, dx * dx + dy * dy, pressure[i], pv[i]);
+                    correctionX[i] += dx * coefficient;
+                    correctionY[i] += dy * coefficient;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < x.size(); i++){
+        x[i] += correctionX[i];
+        y[i] += correctionY[i];
+        vx[i] = (x[i] - previousX[i]) / Solver::DT;
+        vy[i] = (y[i] - previousY[i]) / Solver::DT;
+        cpu::WallKick(walls, x[i], y[i], vx[i], vy[i]);
+    }
+}
+
+void CpuSolver::Update(){
+    for (int step = 0; step < Solver::SOLVER_STEPS; step++){
+        Integrate();
+        Bin();
+        PressureSolve();
+        ProjectionCorrection();
+    }
+}
+
+std::vector<float> CpuSolver::ReadPositions() const{
+    std::vector<float> positions(2 * x.size());
+    for (size_t slot = 0; slot < x.size(); slot++){
+        positions[2 * ids[slot]] = x[slot];
+        positions[2 * ids[slot] + 1] = y[slot];
+    }
+    return positions;
+}
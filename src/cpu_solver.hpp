@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "particles.hpp"
+#include "solver.hpp"
+#include "cpu_kernels.hpp"
+
+/**
+ * @class CpuSolver
+ * @brief The solver's substep on the CPU, over structure of arrays particles in cell order
+ *
+ * Every substep bins the particles into cells one smoothing length wide and reorders x, y and
+ * the other fields by cell, so the three cells of a stencil row are one contiguous range. The
+ * density and correction passes then run per cell: the particles of the cell form a tile that
+ * is tested against the three row ranges while they are in cache, by tile kernels built for
+ * AVX-512, AVX2 or plain scalar code and picked at runtime from CPUID. The wall particles are
+ * binned once and handled by scalar loops, only the particles next to a wall reach them.
+ *
+ * It mirrors the GPU kernels' math with the parameters and scene of a Solver, for running and
+ * timing the scene without a GPU, in the uncapped configuration --validate checks: every pair
+ * within the smoothing length counts. The GPU kernels stop accumulating after neighbourCap
+ * neighbours in their own visiting order, so in cells denser than the cap the two differ.
+ */
+class CpuSolver
+{
+private:
+    // fluid particles, reordered by cell every substep
+    std::vector<float> x, y, vx, vy;
+    std::vector<float> previousX, previousY;
+    std::vector<float> pressure, pv;
+    std::vector<uint32_t> ids;          // index of each slot's particle in Particles
+    std::vector<uint32_t> cellStart;    // first slot of every cell, one past the last cell at the end
+
+    // wall particles, binned once
+    std::vector<float> wallX, wallY;
+    std::vector<uint32_t> wallStart;
+
+    // binning and correction scratch
+    std::vector<uint32_t> cells, order;
+    std::vector<float> correctionX, correctionY;
+    std::vector<float> sum3, sum4;
+
+    std::vector<float> initialPositions;
+
+    int gridWidth;
+    int gridHeight;
+    float cellSize;
+
+    cpu::PairConstants constants;
+    cpu::Walls walls;
+    glm::vec2 gravity;
+    float restDensity;
+
+    cpu::Simd simd;
+    cpu::TileKernels kernels;
+
+    int CellIndex(float px, float py) const;
+    template <typename T> void Permute(std::vector<T>& values);
+    void BinWalls();
+
+    void Integrate();
+    void Bin();
+    void PressureSolve();
+    void ProjectionCorrection();
+
+public:
+    /**
+     * @brief Copy the parameters, the initial positions and the walls of a solver's scene
+     */
+    CpuSolver(const Solver& solver, const Particles& particles);
+
+    /**
+     * @brief Select the tile kernels, clamped to what the CPU supports
+     */
+    void SetSimd(cpu::Simd _simd);
+    cpu::Simd GetSimd() const;
+
+    /**
+     * @brief Restore the initial positions and zero the velocities
+     */
+    void Reset();
+
+    /**
+     * @brief Advance one frame, Solver::SOLVER_STEPS substeps
+     */
+    void Update();
+
+    /**
+     * @brief Positions as interleaved vec2, in the particles' original order
+     */
+    std::vector<float> ReadPositions() const;
+};
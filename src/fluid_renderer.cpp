@@ -0,0 +1,164 @@
+#include "fluid_renderer.hpp"
+
+FluidRenderer::FluidRenderer(int screen_width, int screen_height)
+    : screenWidth(screen_width), screenHeight(screen_height){
+
+    depthShader = new Shader("Fluid Depth", "./shaders/fluid/splat.vert", "./shaders/fluid/depth.frag");
+    thicknessShader = new Shader("Fluid Thickness", "./shaders/fluid/splat.vert", "./shaders/fluid/thickness.frag");
+    blurShader = new Shader("Fluid Blur", "./shaders/fluid/fullscreen.vert", "./shaders/fluid/blur.frag");
+    shadeShader = new Shader("Fluid Shade", "./shaders/fluid/fullscreen.vert", "./shaders/fluid/shade.frag");
+
+    // the fullscreen triangle is generated from gl_VertexID
+    glGenVertexArrays(1, &VAO);
+
+    createTargets();
+}
+
+FluidRenderer::~FluidRenderer(){
+    deleteTargets();
+    glDeleteVertexArrays(1, &VAO);
+
+    delete depthShader;
+    delete thicknessShader;
+    delete blurShader;
+    delete shadeShader;
+}
+
+static unsigned int createTarget(unsigned int fbo, unsigned int format, int width, int height){
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    return texture;
+}
+
+void FluidRenderer::createTargets(){
+    width = std::max(screenWidth / (int)resolution, 1);
+    height = std::max(screenHeight / (int)resolution, 1);
+
+    glGenFramebuffers(1, &heightFBO);
+    glGenFramebuffers(1, &thicknessFBO);
+    glGenFramebuffers(1, &blurFBO);
+
+    heightTexture = createTarget(heightFBO, GL_R32F, width, height);
+    glGenRenderbuffers(1, &depthRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+
+    thicknessTexture = createTarget(thicknessFBO, GL_R16F, width, height);
+    blurTexture = createTarget(blurFBO, GL_R32F, width, height);
+
+    for (unsigned int fbo : {heightFBO, thicknessFBO, blurFBO}){
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "FluidRenderer::ERROR::FRAMEBUFFER_INCOMPLETE" << std::endl;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+void FluidRenderer::deleteTargets(){
+    unsigned int fbos[] = {heightFBO, thicknessFBO, blurFBO};
+    unsigned int textures[] = {heightTexture, thicknessTexture, blurTexture};
+    glDeleteFramebuffers(3, fbos);
+    glDeleteTextures(3, textures);
+    glDeleteRenderbuffers(1, &depthRBO);
+}
+
+void FluidRenderer::resize(int screen_width, int screen_height){
+    if (screen_width == screenWidth && screen_height == screenHeight) return;
+    screenWidth = screen_width;
+    screenHeight = screen_height;
+    deleteTargets();
+    createTargets();
+}
+
+void FluidRenderer::setResolution(Resolution _resolution){
+    if (_resolution == resolution) return;
+    resolution = _resolution;
+    deleteTargets();
+    createTargets();
+}
+
+void FluidRenderer::draw(Particles& particles, glm::mat4& projection, float alpha){
+    float radius = radiusScale * Particles::radius;
+
+    glViewport(0, 0, width, height);
+    glDisable(GL_BLEND);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+    // height of the nearest sphere per pixel
+    glBindFramebuffer(GL_FRAMEBUFFER, heightFBO);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    depthShader->use();
+    depthShader->setMat4("projection", projection);
+    depthShader->setFloat("radius", radius);
+    depthShader->setFloat("alpha", alpha);
+    depthShader->setFloat2v("viewportSize", width, height);
+    particles.draw(*depthShader);
+    glDisable(GL_DEPTH_TEST);
+
+    // accumulated thickness
+    glBindFramebuffer(GL_FRAMEBUFFER, thicknessFBO);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    thicknessShader->use();
+    thicknessShader->setMat4("projection", projection);
+    thicknessShader->setFloat("radius", radius);
+    thicknessShader->setFloat("alpha", alpha);
+    thicknessShader->setFloat2v("viewportSize", width, height);
+    particles.draw(*thicknessShader);
+    glDisable(GL_BLEND);
+
+    // separable bilateral smoothing, height -> blur -> height
+    glBindVertexArray(VAO);
+    glActiveTexture(GL_TEXTURE0);
+    blurShader->use();
+    blurShader->setInt("heightMap", 0);
+    blurShader->setInt("filterRadius", filterRadius);
+    blurShader->setFloat("depthFalloff", depthFalloff / radius);
+    for (int i = 0; i < blurIterations; i++){
+        glBindFramebuffer(GL_FRAMEBUFFER, blurFBO);
+        glBindTexture(GL_TEXTURE_2D, heightTexture);
+        blurShader->setFloat2v("direction", 1.0f / width, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, heightFBO);
+        glBindTexture(GL_TEXTURE_2D, blurTexture);
+        blurShader->setFloat2v("direction", 0.0f, 1.0f / height);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    // normals and shading, upsampled into the default framebuffer
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, screenWidth, screenHeight);
+    shadeShader->use();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, heightTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, thicknessTexture);
+    shadeShader->setInt("heightMap", 0);
+    shadeShader->setInt("thicknessMap", 1);
+    shadeShader->setFloat2v("texel", 1.0f / width, 1.0f / height);
+    shadeShader->setFloat2v("texelWorld", 2.0f / (projection[0][0] * width), 2.0f / (projection[1][1] * height));
+    float absorb[3] = {absorption.x, absorption.y, absorption.z};
+    shadeShader->setFloat3v("absorption", absorb);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
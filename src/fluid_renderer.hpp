@@ -0,0 +1,90 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "shader.hpp"
+#include "particles.hpp"
+
+/**
+ * @class FluidRenderer
+ * @brief Screen-space fluid surface renderer
+ * 
+ * Splats the particles as spheres into a height and a thickness buffer, smooths the height
+ * with a separable bilateral filter, reconstructs normals from it and shades the surface.
+ * The offscreen buffers can run at a fraction of the window resolution, so the fill cost
+ * of the splats and the filter is bounded regardless of the particle count.
+ */
+class FluidRenderer
+{
+public:
+    enum class Resolution
+    {
+        FULL = 1,
+        HALF = 2,
+        QUARTER = 4
+    };
+
+private:
+    int screenWidth;
+    int screenHeight;
+    int width;
+    int height;
+    Resolution resolution = Resolution::HALF;
+
+    unsigned int heightFBO;
+    unsigned int thicknessFBO;
+    unsigned int blurFBO;
+    unsigned int heightTexture;
+    unsigned int thicknessTexture;
+    unsigned int blurTexture;
+    unsigned int depthRBO;
+    unsigned int VAO;
+
+    Shader* depthShader;
+    Shader* thicknessShader;
+    Shader* blurShader;
+    Shader* shadeShader;
+
+    /**
+     * @brief (Re)create the offscreen targets for the current size and resolution
+     */
+    void createTargets();
+
+    /**
+     * @brief Delete the offscreen targets
+     */
+    void deleteTargets();
+
+public:
+    // splat radius relative to Particles::radius, large enough for neighbours to overlap
+    float radiusScale = 2.5f;
+    int blurIterations = 2;
+    int filterRadius = 6;
+    float depthFalloff = 40.0f;
+    glm::vec3 absorption = glm::vec3(3.0f, 1.2f, 0.4f);
+
+public:
+    FluidRenderer(int screen_width, int screen_height);
+    ~FluidRenderer();
+
+    /**
+     * @brief Resize the offscreen targets to follow the window
+     */
+    void resize(int screen_width, int screen_height);
+
+    /**
+     * @brief Render the offscreen targets at a fraction of the window resolution
+     */
+    void setResolution(Resolution _resolution);
+
+    Resolution getResolution() const { return resolution; }
+
+    /**
+     * @brief Render the fluid surface into the default framebuffer
+     * 
+     * @param particles The particles to splat
+     * @param projection The world to clip space projection used for the particles
+     * @param alpha Interpolation factor between the previous and the latest simulated frame
+     */
+    void draw(Particles& particles, glm::mat4& projection, float alpha);
+};
@@ -74,7 +74,7 @@ void Logger::logIndexes(){
     std::stringstream ss;
     ss << "Spatial Indices: ";
     for (size_t i = 0; i < particles->num_particles; i++){
-        ss << spatial_indices_data[i* 3 + 2] << ", ";
+        ss << spatial_indices_data[i * 2 + 1] << ", ";
     }
 
     logPrint(ss.str(), LogType::INFO);
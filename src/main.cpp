@@ -2,9 +2,19 @@
 #include "utils.hpp"
 #include "particles.hpp"
 #include "solver.hpp"
+#include "fluid_renderer.hpp"
+#include "stepper.hpp"
+#include "benchmark.hpp"
+#include "autotune.hpp"
+#include "state_hash.hpp"
+#include "validation.hpp"
+#include "cpu_solver.hpp"
+#include <chrono>
+#include <iomanip>
 
 
 Shader* shader;
+FluidRenderer* fluidRenderer;
 int screenWidth = 1280;
 int screenHeight = 720;
 float viewport_width = 12.5f;
@@ -12,6 +22,9 @@ float viewport_height = screenHeight * viewport_width / screenWidth;
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height){
     glViewport(0, 0, width, height);
+    screenWidth = width;
+    screenHeight = height;
+    if (fluidRenderer) fluidRenderer->resize(width, height);
 }
 
 
@@ -20,16 +33,54 @@ int main(int argc, char *argv[]){
     glm::vec2 gravity = glm::vec2{0.0f, -9.81f};
     float surface_tension = 1e-4;
     float rest_density = 45.0f;
+    // the strategy an earlier --autotune-strategy run picked, the flags below override it
+    const std::string strategy_path = Shader::cacheDirectory + "/strategy.txt";
+    tune::Strategy strategy;
+    tune::LoadStrategy(strategy_path, strategy);
+    bool adaptive_caps = false;
+    bool subgroups = true;
+    bool deterministic = false;
+    int hash_frames = 0;
+    int validate_frames = 0;
+    std::string hash_reference;
+    int benchmark_frames = 0;
+    int key_benchmark_frames = 0;
+    int tune_frames = 0;
+    int strategy_frames = 0;
+    int cpu_benchmark_frames = 0;
 
     for (int i = 1; i < argc; i++){
         if      (std::strncmp(argv[i], "--no-g", 6) == 0)       gravity = glm::vec2{0.0f, 0.0f};
         else if (std::strncmp(argv[i], "--high-st", 9) == 0)    surface_tension = 5e-4;
         else if (std::strncmp(argv[i], "--high-rd", 9) == 0)    rest_density = 450.0f;
+        else if (std::strncmp(argv[i], "--unfused", 9) == 0)    strategy.fusedKernels = false;
+        else if (std::strncmp(argv[i], "--radix", 7) == 0)      strategy.sortAlgorithm = SortAlgorithm::RADIX;
+        else if (std::strncmp(argv[i], "--incremental", 13) == 0) strategy.sortAlgorithm = SortAlgorithm::INCREMENTAL;
+        else if (std::strncmp(argv[i], "--verlet", 8) == 0)     strategy.traversal = NeighbourTraversal::VERLET;
+        else if (std::strncmp(argv[i], "--cells", 7) == 0)      strategy.traversal = NeighbourTraversal::CELLS;
+        else if (std::strncmp(argv[i], "--morton", 8) == 0)     strategy.cellKeys = CellKeys::MORTON;
+        else if (std::strncmp(argv[i], "--adaptive-caps", 15) == 0) adaptive_caps = true;
+        else if (std::strncmp(argv[i], "--no-subgroups", 14) == 0) subgroups = false;
+        else if (std::strncmp(argv[i], "--deterministic", 15) == 0) deterministic = true;
+        else if (std::strncmp(argv[i], "--hash-state", 12) == 0) hash_frames = argv[i][12] == '=' ? std::atoi(argv[i] + 13) : 300;
+        else if (std::strncmp(argv[i], "--hash-compare=", 15) == 0) hash_reference = argv[i] + 15;
+        else if (std::strncmp(argv[i], "--validate", 10) == 0)  validate_frames = argv[i][10] == '=' ? std::atoi(argv[i] + 11) : 3;
+        else if (std::strcmp(argv[i], "--stencil=fine") == 0)   strategy.searchStencil = SearchStencil::FINE_5X5;
+        else if (std::strcmp(argv[i], "--stencil=quadrant") == 0) strategy.searchStencil = SearchStencil::QUADRANT_2X2;
+        else if (std::strncmp(argv[i], "--benchmark-cpu", 15) == 0) cpu_benchmark_frames = argv[i][15] == '=' ? std::atoi(argv[i] + 16) : 60;
+        else if (std::strncmp(argv[i], "--benchmark-keys", 16) == 0) key_benchmark_frames = argv[i][16] == '=' ? std::atoi(argv[i] + 17) : 300;
+        else if (std::strncmp(argv[i], "--autotune-strategy", 19) == 0) strategy_frames = argv[i][19] == '=' ? std::atoi(argv[i] + 20) : 120;
+        else if (std::strncmp(argv[i], "--autotune", 10) == 0)  tune_frames = argv[i][10] == '=' ? std::atoi(argv[i] + 11) : 60;
+        else if (std::strncmp(argv[i], "--benchmark", 11) == 0) benchmark_frames = argv[i][11] == '=' ? std::atoi(argv[i] + 12) : 300;
     }
 
 
 
-    GLFWwindow *window = utils::setupWindow(screenWidth, screenHeight);
+    // validation runs without a display, on Mesa's llvmpipe unless the environment picks a driver
+    bool headless = validate_frames > 0;
+    if (headless) setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+
+    GLFWwindow *window = utils::setupWindow(screenWidth, screenHeight, headless);
     ImGuiIO &io = ImGui::GetIO();
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
@@ -49,15 +100,14 @@ int main(int argc, char *argv[]){
 
     float x0 = start_x;
 
-    float spacing = Particles::radius;
     for (int i = 0; i < particles_per_row; i++){
         for (int j = 0; j < particles_per_col; j++){
             positions.push_back(start_x);
             positions.push_back(start_y);
-            start_x += 2.0f * Particles::radius + spacing;
+            start_x += Solver::PARTICLE_SPACING;
         }
         start_x = x0;
-        start_y -= 2.0f * Particles::radius + spacing;
+        start_y -= Solver::PARTICLE_SPACING;
     }
 
 
@@ -68,27 +118,261 @@ int main(int argc, char *argv[]){
     solver.SetGravity(gravity);
     solver.SetSurfaceTension(surface_tension);
     solver.SetRestDensity(rest_density);
+    tune::ApplyStrategy(solver, strategy);
+    solver.SetAdaptiveCaps(adaptive_caps);
+    solver.SetSubgroups(subgroups);
+    solver.SetDeterministic(deterministic);
+    std::cout << solver.SubgroupReport() << std::endl;
+
+    // workgroup sizes tuned on this device by an earlier --autotune run
+    const std::string tune_cache = Shader::cacheDirectory + "/workgroup_sizes.txt";
+    tune::LoadLocalSizes(solver, tune_cache);
+
+    if (tune_frames > 0){
+        tune::TuneLocalSizes(solver, particles, tune_frames);
+        tune::SaveLocalSizes(solver, tune_cache);
+        std::cout << "Saved workgroup sizes for " << tune::DeviceKey() << " to " << tune_cache << std::endl;
+        utils::cleanup(window);
+        return 0;
+    }
+
+    if (validate_frames > 0){
+        Validator validator(&solver, &particles);
+        bool valid = validator.Run(validate_frames);
+        validator.Print();
+        std::cout << (valid ? "All passes match the CPU reference" : "GPU and CPU reference diverged") << std::endl;
+        utils::cleanup(window);
+        return valid ? 0 : 1;
+    }
+
+    if (hash_frames > 0){
+        // one line per frame on stdout, a later run or another build compares against the saved output
+        std::vector<uint64_t> hashes = state::Record(solver, particles, hash_frames);
+        state::Save(hashes, std::cout);
+
+        int status = 0;
+        std::vector<uint64_t> reference;
+        if (!hash_reference.empty()){
+            if (!state::Load(hash_reference, reference)){
+                std::cerr << "Cannot read any hashes from " << hash_reference << std::endl;
+                status = 1;
+            }
+            else if (int frame = state::FirstMismatch(hashes, reference); frame >= 0){
+                std::cerr << "State differs from " << hash_reference << " from frame " << frame
+                          << " (" << hashes.size() << " frames recorded, " << reference.size() << " in the reference)" << std::endl;
+                status = 1;
+            }
+            else std::cerr << "State matches " << hash_reference << " over " << hashes.size() << " frames" << std::endl;
+        }
+        utils::cleanup(window);
+        return status;
+    }
+
+    if (strategy_frames > 0){
+        tune::Strategy best = tune::TuneStrategy(solver, particles, strategy_frames);
+        tune::SaveStrategy(best, strategy_path, particles.count());
+        std::cout << "Saved strategy to " << strategy_path << std::endl;
+        utils::cleanup(window);
+        return 0;
+    }
+
+    if (benchmark_frames > 0){
+        // candidates the cell search tests at the density the scene settled to
+        auto with_search = [&solver](bench::Result result){
+            SearchStats stats = solver.MeasureSearch();
+            result.metrics = {{"Candidates/particle", stats.candidates}, {"Neighbours/particle", stats.neighbours}};
+            return result;
+        };
+
+        std::vector<bench::Result> results;
+        results.push_back(with_search(bench::Run(solver, particles, "global", [](Solver& s){
+            s.SetSearchStencil(SearchStencil::CELLS_3X3);
+            s.SetNeighbourTraversal(NeighbourTraversal::GLOBAL);
+        }, benchmark_frames)));
+        results.push_back(bench::Run(solver, particles, "tiled", [](Solver& s){ s.SetNeighbourTraversal(NeighbourTraversal::TILED); }, benchmark_frames));
+        results.push_back(bench::Run(solver, particles, "radix", [](Solver& s){
+            s.SetNeighbourTraversal(NeighbourTraversal::GLOBAL);
+            s.SetSortAlgorithm(SortAlgorithm::RADIX);
+        }, benchmark_frames));
+        results.push_back(bench::Run(solver, particles, "incremental", [](Solver& s){
+            s.SetNeighbourTraversal(NeighbourTraversal::GLOBAL);
+            s.SetSortAlgorithm(SortAlgorithm::INCREMENTAL);
+        }, benchmark_frames));
+        results.push_back(bench::Run(solver, particles, "verlet", [](Solver& s){
+            s.SetSortAlgorithm(SortAlgorithm::BITONIC);
+            s.SetNeighbourTraversal(NeighbourTraversal::VERLET);
+        }, benchmark_frames));
+        results.push_back(bench::Run(solver, particles, "cells", [](Solver& s){ s.SetNeighbourTraversal(NeighbourTraversal::CELLS); }, benchmark_frames));
+        results.push_back(with_search(bench::Run(solver, particles, "fine 5x5", [](Solver& s){
+            s.SetNeighbourTraversal(NeighbourTraversal::GLOBAL);
+            s.SetSearchStencil(SearchStencil::FINE_5X5);
+        }, benchmark_frames)));
+        results.push_back(with_search(bench::Run(solver, particles, "quadrant 2x2", [](Solver& s){
+            s.SetSearchStencil(SearchStencil::QUADRANT_2X2);
+        }, benchmark_frames)));
+        bench::Print(results);
+        utils::cleanup(window);
+        return 0;
+    }
+
+    if (key_benchmark_frames > 0){
+        // row-major keys put vertical neighbours a grid row apart, which hurts more the wider the domain
+        std::vector<bench::Result> results;
+        for (float width : {viewport_width, 4 * viewport_width, 16 * viewport_width}){
+            std::vector<float> layer;
+            for (float y = 2 * Particles::radius; y < 0.2f * viewport_height; y += Solver::PARTICLE_SPACING)
+                for (float x = 2 * Particles::radius; x < 0.9f * width; x += Solver::PARTICLE_SPACING)
+                    layer.insert(layer.end(), {x, y});
+
+            Particles wide(layer);
+            Solver wide_solver(&wide, width, viewport_height);
+            wide_solver.SetGravity(gravity);
+            tune::ApplyStrategy(wide_solver, strategy);
+            wide_solver.SetSubgroups(subgroups);
+            tune::LoadLocalSizes(wide_solver, tune_cache);
+
+            for (CellKeys keys : {CellKeys::ROW_MAJOR, CellKeys::MORTON}){
+                std::string label = (keys == CellKeys::MORTON ? "morton " : "row ") + std::to_string((int)width);
+                bench::Result result = bench::Run(wide_solver, wide, label, [keys](Solver& s){ s.SetCellKeys(keys); }, key_benchmark_frames);
+                KeyLocality locality = wide_solver.MeasureKeyLocality();
+                result.metrics = {
+                    {"Index lines/workgroup", locality.indexLines},
+                    {"Offset lines/workgroup", locality.offsetLines},
+                    {"Key span/particle", locality.keySpan}
+                };
+                results.push_back(result);
+            }
+        }
+        bench::Print(results);
+        utils::cleanup(window);
+        return 0;
+    }
+
+    if (cpu_benchmark_frames > 0){
+        // the same scene on the CPU with every tile kernel this CPU runs, checked against the scalar one
+        CpuSolver cpu_solver(solver, particles);
+        std::vector<float> scalar_positions;
+        for (cpu::Simd simd : {cpu::Simd::SCALAR, cpu::Simd::AVX2, cpu::Simd::AVX512}){
+            if (simd > cpu::DetectSimd()) break;
+            cpu_solver.SetSimd(simd);
+            cpu_solver.Reset();
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < cpu_benchmark_frames; i++) cpu_solver.Update();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            std::vector<float> cpu_positions = cpu_solver.ReadPositions();
+            if (simd == cpu::Simd::SCALAR) scalar_positions = cpu_positions;
+            float deviation = 0.0f;
+            for (size_t i = 0; i < cpu_positions.size(); i++) deviation = std::max(deviation, std::abs(cpu_positions[i] - scalar_positions[i]));
+
+            std::cout << std::left << std::setw(8) << cpu::SimdName(simd) << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(10) << ms / cpu_benchmark_frames << " ms/frame" << std::scientific << std::setprecision(2)
+                      << "  max deviation from scalar " << deviation << std::defaultfloat << std::endl;
+        }
+        utils::cleanup(window);
+        return 0;
+    }
+
+    fluidRenderer = new FluidRenderer(screenWidth, screenHeight);
+    // the UI shows the sort, Verlet and neighbour counters
+    solver.SetStatsReadback(true);
+    bool renderSurface = false;
+    int surfaceResolution = 1; // index into {full, half, quarter}
 
     glm::mat4 projection = glm::ortho(0.0f, viewport_width, 0.0f, viewport_height, 0.0f, 1.0f);
 
     shader->use();
     shader->setMat4("projection", projection);
 
-    float dt = 1.0f / (float)(10 * 60);
+    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    Stepper stepper(&solver, &particles, mode ? mode->refreshRate : 60);
+    bool vsync = true;
+    SearchStats search_stats;
 
     while (!glfwWindowShouldClose(window)){
         glfwPollEvents();
 
+        // present at the monitor rate, the stepper decides how many frames to simulate
+        if (vsync == stepper.unthrottled){
+            vsync = !stepper.unthrottled;
+            glfwSwapInterval(vsync ? 1 : 0);
+        }
+        if (!stepper.advance()) continue;
+
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
-        
-        solver.Update();
-
         {
             ImGui::Begin("Frames");
             ImGui::Text("%.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+            ImGui::Text("%.1f simulated frames/s", stepper.getSimFramesPerSecond());
+            ImGui::Checkbox("Unthrottled simulation", &stepper.unthrottled);
+            ImGui::Checkbox("Pause", &stepper.paused);
+            ImGui::End();
+
+            PassGraph& passGraph = solver.GetPassGraph();
+            ImGui::Begin("Solver Passes");
+            bool profiling = passGraph.IsProfiling();
+            if (ImGui::Checkbox("GPU timings", &profiling)) passGraph.SetProfiling(profiling);
+            bool fused = solver.GetFusedKernels();
+            if (ImGui::Checkbox("Fused kernels", &fused)) solver.SetFusedKernels(fused);
+            if (solver.GetSubgroupSupport().compute){
+                bool use_subgroups = solver.GetSubgroups();
+                if (ImGui::Checkbox("Subgroup scans", &use_subgroups)) solver.SetSubgroups(use_subgroups);
+            }
+            bool is_deterministic = solver.GetDeterministic();
+            if (ImGui::Checkbox("Deterministic", &is_deterministic)) solver.SetDeterministic(is_deterministic);
+            int traversal = (int)solver.GetNeighbourTraversal();
+            const char* traversals[] = {"Global", "Tiled", "Verlet lists", "Cell-centric"};
+            if (ImGui::Combo("Neighbour traversal", &traversal, traversals, 4))
+                solver.SetNeighbourTraversal((NeighbourTraversal)traversal);
+            if (solver.GetNeighbourTraversal() == NeighbourTraversal::VERLET){
+                float skin = solver.GetVerletSkin() / Solver::GetSmoothingLength();
+                if (ImGui::SliderFloat("Skin (x smoothing length)", &skin, 0.05f, 1.0f))
+                    solver.SetVerletSkin(skin * Solver::GetSmoothingLength());
+                const VerletStats& stats = solver.GetVerletStats();
+                ImGui::Text("lists rebuilt in %u of %u substeps", stats.rebuilds, stats.substeps);
+            }
+            int keys = (int)solver.GetCellKeys();
+            const char* key_orders[] = {"Row-major", "Morton"};
+            if (ImGui::Combo("Cell keys", &keys, key_orders, 2)) solver.SetCellKeys((CellKeys)keys);
+            int stencil = (int)solver.GetSearchStencil();
+            const char* stencils[] = {"3x3, h cells", "5x5, h/2 cells", "2x2 quadrant, 2h cells"};
+            if (ImGui::Combo("Search stencil", &stencil, stencils, 3)) solver.SetSearchStencil((SearchStencil)stencil);
+            if (ImGui::Button("Measure search")) search_stats = solver.MeasureSearch();
+            ImGui::SameLine();
+            ImGui::Text("%.1f candidates, %.1f neighbours/particle", search_stats.candidates, search_stats.neighbours);
+            const NeighbourStats& neighbours = solver.GetNeighbourStats();
+            bool adaptive = solver.GetAdaptiveCaps();
+            if (ImGui::Checkbox("Adaptive neighbour caps", &adaptive)) solver.SetAdaptiveCaps(adaptive);
+            ImGui::Text("cap %d neighbours, %d list slots, most seen %u", solver.GetNeighbourCap(), solver.GetVerletCapacity(), neighbours.maxCount);
+            ImGui::Text("%u particles over the cap, %u lists full", neighbours.overflow, neighbours.listOverflow);
+            if (!neighbours.histogram.empty()){
+                std::vector<float> bins(neighbours.histogram.begin(), neighbours.histogram.end());
+                std::string overlay = std::to_string(Solver::NEIGHBOUR_BIN_WIDTH) + " neighbours per bin";
+                ImGui::PlotHistogram("Neighbours", bins.data(), (int)bins.size(), 0, overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0, 60));
+            }
+            int sort = (int)solver.GetSortAlgorithm();
+            const char* sorts[] = {"Bitonic", "Radix", "Incremental"};
+            if (ImGui::Combo("Sort", &sort, sorts, 3)) solver.SetSortAlgorithm((SortAlgorithm)sort);
+            if (solver.GetSortAlgorithm() == SortAlgorithm::INCREMENTAL){
+                const SortStats& stats = solver.GetSortStats();
+                ImGui::Text("sorts skipped %u, fixed up %u, full %u", stats.skipped, stats.fixedUp, stats.full);
+                ImGui::Text("%u particles changed cell", stats.changed);
+            }
+            ImGui::Text("%zu barriers/frame", passGraph.GetBarrierCount());
+            for (const auto& timing : passGraph.GetTimings())
+                ImGui::Text("%-24s %7.3f ms", timing.name.c_str(), timing.ms);
+            ImGui::End();
+
+            ImGui::Begin("Rendering");
+            ImGui::Checkbox("Fluid surface", &renderSurface);
+            const char* resolutions[] = {"Full", "Half", "Quarter"};
+            if (ImGui::Combo("Surface resolution", &surfaceResolution, resolutions, 3))
+                fluidRenderer->setResolution((FluidRenderer::Resolution)(1 << surfaceResolution));
+            ImGui::SliderInt("Blur iterations", &fluidRenderer->blurIterations, 0, 8);
             ImGui::End();
         }
 
@@ -98,19 +382,27 @@ int main(int argc, char *argv[]){
         glClear(GL_COLOR_BUFFER_BIT);
 
 
-        glDisable(GL_POINT_SMOOTH);
-        shader->use();
-        shader->setMat4("projection", projection);
+        if (renderSurface){
+            fluidRenderer->draw(particles, projection, stepper.getAlpha());
+        } else {
+            // sprites are opaque and discard outside the circle, so skip blending
+            glDisable(GL_POINT_SMOOTH);
+            glDisable(GL_BLEND);
+            shader->use();
+            shader->setMat4("projection", projection);
+            shader->setFloat("radius", Particles::radius);
+            shader->setFloat("alpha", stepper.getAlpha());
+            shader->setFloat2v("viewportSize", screenWidth, screenHeight);
 
-        particles.draw(*shader);
+            particles.draw(*shader);
+        }
 
 
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         glfwSwapBuffers(window);
-        glfwSwapInterval(0);
-
     }
 
+    delete fluidRenderer;
     utils::cleanup(window);
 
     return 0;
@@ -14,7 +14,7 @@ Particles::Particles(std::vector<float> _positions) : positions(_positions){
     pvs.resize(num_particles);
 
 
-    spatialIndices.resize(num_particles * 4); // stores (original index, hash, and cellPosx, cellPosy)
+    spatialIndices.resize(num_particles * 2); // stores (original index, hash)
 
 
     // create the index array
@@ -32,49 +32,62 @@ void Particles::setupSSBO(){
     glGenBuffers(1, &positionSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, positionSSBO);
     glBufferData(GL_SHADER_STORAGE_BUFFER, positions.size() * sizeof(float), positions.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, positionSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::POSITION, positionSSBO);
 
     // velocity
     glGenBuffers(1, &velocitySSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, velocitySSBO);
     glBufferData(GL_SHADER_STORAGE_BUFFER, velocities.size() * sizeof(float), velocities.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, velocitySSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::VELOCITY, velocitySSBO);
+
+    // correction targets, swapped with position and velocity every substep
+    glGenBuffers(1, &positionOutSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, positionOutSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, positions.size() * sizeof(float), positions.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::POSITION_OUT, positionOutSSBO);
+
+    glGenBuffers(1, &velocityOutSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, velocityOutSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, velocities.size() * sizeof(float), velocities.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::VELOCITY_OUT, velocityOutSSBO);
 
     // previous position
     glGenBuffers(1, &previousPositionSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, previousPositionSSBO);
     glBufferData(GL_SHADER_STORAGE_BUFFER, previous_positions.size() * sizeof(float), previous_positions.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, previousPositionSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::PREVIOUS_POSITION, previousPositionSSBO);
 
     // pressure
     glGenBuffers(1, &pressureSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, pressureSSBO);
     glBufferData(GL_SHADER_STORAGE_BUFFER, pressures.size() * sizeof(float), pressures.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, pressureSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::PRESSURE, pressureSSBO);
 
     // pv
     glGenBuffers(1, &pvSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, pvSSBO);
     glBufferData(GL_SHADER_STORAGE_BUFFER, pvs.size() * sizeof(float), pvs.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, pvSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::PV, pvSSBO);
 
     // spatial indices
     glGenBuffers(1, &spatialIndexSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, spatialIndexSSBO);
     glBufferData(GL_SHADER_STORAGE_BUFFER, spatialIndices.size() * sizeof(int), spatialIndices.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, spatialIndexSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::SPATIAL_INDEX, spatialIndexSSBO);
+
+    // positions at the start of the latest frame
+    glGenBuffers(1, &framePositionSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, framePositionSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, positions.size() * sizeof(float), positions.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::FRAME_POSITION, framePositionSSBO);
 
     // // spatial offsets being set in solver
 
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+    // no vertex attributes, circle.vert pulls positions from positionSSBO by gl_VertexID
     glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, positionSSBO);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
 
 }
 
@@ -85,6 +98,37 @@ Particles::~Particles(){
 void Particles::getSSBOData(){
 }
 
+void Particles::reset(){
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, positionSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(float), positions.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, framePositionSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(float), positions.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, previousPositionSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(float), positions.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, velocitySSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, velocities.size() * sizeof(float), velocities.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Particles::storeFramePositions(){
+    // the copy reads what the solver's compute passes wrote
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, positionSSBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, framePositionSSBO);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, num_particles * 2 * sizeof(float));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void Particles::swapStateBuffers(){
+    std::swap(positionSSBO, positionOutSSBO);
+    std::swap(velocitySSBO, velocityOutSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::POSITION, positionSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::VELOCITY, velocitySSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::POSITION_OUT, positionOutSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::VELOCITY_OUT, velocityOutSSBO);
+}
+
 void Particles::draw(Shader& shader){
     shader.use();
     getSSBOData();
@@ -7,6 +7,39 @@
 #include <memory>   // for std::unique_ptr
 #include "point.hpp"
 
+/**
+ * @brief SSBO binding points shared by the solver and the render shaders
+ */
+namespace Binding
+{
+    enum : unsigned int
+    {
+        POSITION = 0,
+        VELOCITY = 1,
+        PREVIOUS_POSITION = 2,
+        PRESSURE = 3,
+        PV = 4,
+        SPATIAL_INDEX = 5,
+        SPATIAL_OFFSET = 6,
+        BOUNDARY_POSITION = 7,
+        BOUNDARY_INDEX = 8,
+        BOUNDARY_OFFSET = 9,
+        FRAME_POSITION = 10,
+        SORT_SCRATCH = 11,
+        RADIX_HISTOGRAM = 12,
+        SORT_PLAN = 13,
+        CHANGED_LIST = 14,
+        VERLET_STATE = 15,
+        VERLET_LIST = 16,
+        VERLET_COUNT = 17,
+        VERLET_BUILD_POSITION = 18,
+        CELL_LIST = 19,
+        NEIGHBOUR_COUNTS = 20,
+        POSITION_OUT = 21,
+        VELOCITY_OUT = 22
+    };
+}
+
 /**
  * @class Particles
  * @brief A class to manage all the particles
@@ -34,6 +67,12 @@ private:
     std::vector<int> spatialIndices;
     std::vector<int> spatialOffsets;
 
+    // static boundary particles, binned once at setup
+    std::vector<float> boundary_positions;
+    std::vector<int> boundarySpatialIndices;
+    std::vector<int> boundarySpatialOffsets;
+    size_t num_boundary_particles = 0;
+
 
     // constants
     constexpr static size_t MAX_NEIGHBOURS = 64;
@@ -42,10 +81,14 @@ private:
 
     friend class Solver;
     friend class Logger;
+    friend class Validator;
+    friend class CpuSolver;
 
 private:
     unsigned int positionSSBO;
     unsigned int velocitySSBO;
+    unsigned int positionOutSSBO;   // written by the correction while positionSSBO is read, then swapped
+    unsigned int velocityOutSSBO;
     unsigned int previousPositionSSBO;
     unsigned int predictedPositionSSBO;
 
@@ -54,10 +97,27 @@ private:
     unsigned int pressureSSBO;
     unsigned int pvSSBO;
 
-    unsigned int spatialIndexSSBO; // stores (original index, hash, and key) Stored as (original index, hash, key, 0)
-    unsigned int spatialOffsetSSBO;
+    unsigned int spatialIndexSSBO; // stores uvec2(original index, hash), the cell is recomputed from the position
+    unsigned int spatialOffsetSSBO = 0;
+    unsigned int sortScratchSSBO = 0; // radix sort ping-pong target, swapped with spatialIndexSSBO every pass
+    unsigned int radixHistogramSSBO = 0;
+    unsigned int sortPlanSSBO = 0;      // incremental resort decision, also the indirect dispatch arguments
+    unsigned int changedListSSBO = 0;   // entries that changed cell since the last sort
+
+    unsigned int numNeighboursSSBO;         // Verlet list length per particle
+    unsigned int verletListSSBO = 0;        // Solver::verletCapacity neighbour indices per particle
+    unsigned int verletBuildPositionSSBO = 0;
+    unsigned int verletStateSSBO = 0;       // rebuild decision, also the indirect dispatch arguments
 
-    unsigned int numNeighboursSSBO;
+    unsigned int cellListSSBO = 0;  // workgroup count, then the first slot of every cell block
+
+    unsigned int neighbourCountsSSBO = 0;   // overflow counters and neighbour count histogram of the frame
+
+    unsigned int framePositionSSBO; // positions at the start of the latest simulated frame, for interpolation
+
+    unsigned int boundaryPositionSSBO = 0;
+    unsigned int boundarySpatialIndexSSBO = 0; // same layout as spatialIndexSSBO, sorted once
+    unsigned int boundarySpatialOffsetSSBO = 0;
 
 
     unsigned int VAO;
@@ -83,10 +143,34 @@ public:
     /**
      * @brief Draw all the particles
      * 
-     * Add particles to a VAO and perform a draw call
+     * Issues one point per particle, the shader reads the positions from positionSSBO
+     * and sizes each sprite from Particles::radius
      */
     void draw(Shader& shader);
 
+    /**
+     * @brief Restore the initial positions and zero the velocities
+     */
+    void reset();
+
+    /**
+     * @brief Copy the current positions into framePositionSSBO
+     * 
+     * Called before every simulated frame so the renderer can interpolate between
+     * the previous and the current frame
+     */
+    void storeFramePositions();
+
+    /**
+     * @brief Exchange the position and velocity buffers with their output buffers
+     * 
+     * Only the bindings change, nothing is copied. Called after every correction so the next
+     * pass reads what it wrote.
+     */
+    void swapStateBuffers();
+
+    size_t count() const { return num_particles; }
+
     /**
      * @brief reserve space for the particles
      * 
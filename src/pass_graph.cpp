@@ -0,0 +1,118 @@
+#include "pass_graph.hpp"
+
+PassGraph::~PassGraph(){
+    for (auto& pool : queries)
+        if (!pool.empty()) glDeleteQueries(pool.size(), pool.data());
+}
+
+void PassGraph::AddPass(ComputePass pass){
+    passes.push_back(std::move(pass));
+}
+
+void PassGraph::AddFusion(const std::string& first, const std::string& second, ComputePass fused){
+    fusions.push_back({first, second, std::move(fused)});
+}
+
+std::vector<const ComputePass*> PassGraph::schedule() const{
+    std::vector<const ComputePass*> active;
+    for (const auto& pass : passes)
+        if (!pass.enabled || pass.enabled()) active.push_back(&pass);
+
+    std::vector<const ComputePass*> order;
+    for (size_t i = 0; i < active.size(); i++){
+        const ComputePass* next = active[i];
+        if (i + 1 < active.size()){
+            for (const auto& fusion : fusions){
+                if (fusion.first == active[i]->name && fusion.second == active[i + 1]->name
+                    && (!fusion.fused.enabled || fusion.fused.enabled())){
+                    next = &fusion.fused;
+                    i++;
+                    break;
+                }
+            }
+        }
+        order.push_back(next);
+    }
+    return order;
+}
+
+void PassGraph::timestamp(const std::string& label){
+    size_t pool = frame % 2;
+    if (queryCount[pool] == queries[pool].size()){
+        queries[pool].push_back(0);
+        glGenQueries(1, &queries[pool].back());
+        labels[pool].push_back("");
+    }
+    glQueryCounter(queries[pool][queryCount[pool]], GL_TIMESTAMP);
+    labels[pool][queryCount[pool]] = label;
+    queryCount[pool]++;
+}
+
+void PassGraph::Execute(){
+    for (const ComputePass* pass : schedule()){
+        // read-after-write, write-after-write and write-after-read on any binding
+        uint32_t hazard = (pass->reads & dirty) | (pass->writes & dirty) | (pass->writes & read);
+        if (hazard){
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            dirty = read = 0;
+            barriers++;
+        }
+
+        if (profiling) timestamp(pass->name);
+        pass->record();
+        if (profiling) timestamp("");
+
+        dirty |= pass->writes;
+        read |= pass->reads;
+
+        if (observer){
+            Flush();
+            observer(pass->name);
+        }
+    }
+}
+
+void PassGraph::Flush(){
+    if (!dirty) return;
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    dirty = read = 0;
+    barriers++;
+}
+
+bool PassGraph::resolveTimings(size_t pool){
+    // polled first, GL_QUERY_RESULT of a pending query would wait for the GPU
+    for (size_t i = 0; i < queryCount[pool]; i++){
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(queries[pool][i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return false;
+    }
+
+    timings.clear();
+    for (size_t i = 0; i + 1 < queryCount[pool]; i += 2){
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(queries[pool][i], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[pool][i + 1], GL_QUERY_RESULT, &end);
+        double ms = (end - begin) / 1e6;
+
+        auto it = std::find_if(timings.begin(), timings.end(),
+            [&](const PassTiming& t){ return t.name == labels[pool][i]; });
+        if (it == timings.end()) timings.push_back({labels[pool][i], ms});
+        else it->ms += ms;
+    }
+    resolvedFrames++;
+    return true;
+}
+
+void PassGraph::BeginFrame(){
+    barriers = 0;
+    // a frame the GPU is still on loses its timings, its queries are recorded over
+    size_t pool = frame % 2;
+    if (queryCount[pool] > 0) resolveTimings(pool);
+    queryCount[pool] = 0;
+}
+
+void PassGraph::EndFrame(){
+    Flush();
+    frameBarriers = barriers;
+    frame++;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <initializer_list>
+#include <cstdint>
+
+/**
+ * @brief Bitmask of SSBO binding points, see Binding in particles.hpp
+ */
+constexpr uint32_t BindingMask(std::initializer_list<unsigned int> bindings){
+    uint32_t mask = 0;
+    for (unsigned int binding : bindings) mask |= 1u << binding;
+    return mask;
+}
+
+/**
+ * @struct ComputePass
+ * @brief A compute stage of the solver, with the SSBO bindings it touches
+ */
+struct ComputePass
+{
+    std::string name;
+    uint32_t reads = 0;             // bindings read by the pass
+    uint32_t writes = 0;            // bindings written by the pass
+    std::function<void()> record;   // binds the program, sets the uniforms and dispatches
+    std::function<bool()> enabled;  // optional, the pass is skipped when this returns false
+};
+
+/**
+ * @struct PassTiming
+ * @brief GPU time spent in a pass, summed over all its executions in a frame
+ */
+struct PassTiming
+{
+    std::string name;
+    double ms;
+};
+
+/**
+ * @class PassGraph
+ * @brief Ordered list of compute passes that places the memory barriers itself
+ * 
+ * Each pass declares which bindings it reads and writes. A barrier is only inserted in front
+ * of a pass that reads or writes a binding written since the last barrier, or writes a binding
+ * read since then. Two adjacent passes can be replaced by a registered fused pass. When
+ * profiling is enabled every pass is bracketed by timestamp queries, which are read back two
+ * frames later once the GPU reached them, so the CPU never waits on the GPU.
+ */
+class PassGraph
+{
+private:
+    struct Fusion
+    {
+        std::string first;
+        std::string second;
+        ComputePass fused;
+    };
+
+    std::vector<ComputePass> passes;
+    std::vector<Fusion> fusions;
+
+    // hazard tracking since the last barrier
+    uint32_t dirty = 0;
+    uint32_t read = 0;
+    size_t barriers = 0;
+    size_t frameBarriers = 0;
+
+    // timestamp queries, one pool per frame in flight
+    bool profiling = false;
+    size_t frame = 0;
+    std::vector<unsigned int> queries[2];
+    std::vector<std::string> labels[2];
+    size_t queryCount[2] = {0, 0};
+    std::vector<PassTiming> timings;
+    size_t resolvedFrames = 0;
+
+    std::function<void(const std::string&)> observer;
+
+    /**
+     * @brief Resolve the pass order for this execution, applying the enabled fusions
+     */
+    std::vector<const ComputePass*> schedule() const;
+
+    /**
+     * @brief Read back the timestamps recorded in the given pool, if the GPU reached all of them
+     * 
+     * @return false when some are still pending, the previous timings are then kept
+     */
+    bool resolveTimings(size_t pool);
+
+    void timestamp(const std::string& label);
+
+public:
+    PassGraph() = default;
+    ~PassGraph();
+
+    /**
+     * @brief Append a pass, passes execute in the order they are added
+     */
+    void AddPass(ComputePass pass);
+
+    /**
+     * @brief Register a pass that replaces first immediately followed by second
+     * 
+     * The fused pass's enabled() decides whether the substitution happens.
+     */
+    void AddFusion(const std::string& first, const std::string& second, ComputePass fused);
+
+    /**
+     * @brief Run all enabled passes once, with only the barriers they need
+     */
+    void Execute();
+
+    /**
+     * @brief Make every pending write visible to later shader and buffer reads
+     */
+    void Flush();
+
+    /**
+     * @brief Mark the start of a frame, recycles the timestamp queries of two frames ago
+     * 
+     * Their timings are read if the GPU finished that frame, and dropped otherwise.
+     */
+    void BeginFrame();
+
+    /**
+     * @brief Mark the end of a frame
+     */
+    void EndFrame();
+
+    /**
+     * @brief Call observer with the name of every pass once it ran and its writes are visible
+     * 
+     * For inspection tools, every call flushes, so the barrier count no longer reflects a normal
+     * frame. An empty function removes the observer.
+     */
+    void SetObserver(std::function<void(const std::string&)> _observer) { observer = std::move(_observer); }
+
+    void SetProfiling(bool enable) { profiling = enable; }
+    bool IsProfiling() const { return profiling; }
+
+    /**
+     * @brief GPU time per pass of the latest resolved frame
+     */
+    const std::vector<PassTiming>& GetTimings() const { return timings; }
+
+    /**
+     * @brief Number of frames whose timings were read back so far, grows by at most one per frame
+     */
+    size_t GetResolvedFrames() const { return resolvedFrames; }
+
+    /**
+     * @brief Number of barriers issued during the latest frame
+     */
+    size_t GetBarrierCount() const { return frameBarriers; }
+};
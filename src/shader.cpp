@@ -1,112 +1,247 @@
 #include "shader.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <set>
+
+std::string Shader::cacheDirectory = "./shader_cache";
+
+static std::string readSource(const std::string& name, const char* path){
+    std::ifstream file;
+    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    try {
+        file.open(path);
 
-Shader::Shader(const char* _name, const char* vshaderPath, const char* fshaderPath) : name(_name) {
-    std::ifstream vshaderFile;
-    std::ifstream fshaderFile;
+        std::stringstream stream;
+        stream << file.rdbuf();
+        file.close();
 
-    std::string vshaderSource;
-    std::string fshaderSource;
+        return stream.str();
 
-    vshaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fshaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try {
-        vshaderFile.open(vshaderPath);
-        fshaderFile.open(fshaderPath);
+    } catch (const std::exception &e) {
+        std::cerr << name << "::ERROR::SHADER::FILE_NOT_READ_SUCCESFULLY: " << e.what() << '\n';
+    }
+    return "";
+}
 
-        std::stringstream vShaderStream;
-        std::stringstream fShaderStream;
-        // read file's buffer contents into streams
-        vShaderStream << vshaderFile.rdbuf();
-        fShaderStream << fshaderFile.rdbuf();
-        // close file handlers
-        vshaderFile.close();
-        fshaderFile.close();
+// Splices `#include "file"` lines (paths relative to the including file) into the source, each
+// file at most once. The #line directives number files in inclusion order so compile errors point
+// at "<file number>(<line>)".
+static std::string resolveIncludes(const std::string& name, const std::filesystem::path& path, const std::string& source,
+                                   std::set<std::filesystem::path>& included, int fileNumber, int& fileCount){
+    std::istringstream lines(source);
+    std::string out, line;
+    int lineNumber = 0;
+    while (std::getline(lines, line)){
+        lineNumber++;
+        size_t directive = line.find_first_not_of(" \t");
+        if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0){
+            out += line + "\n";
+            continue;
+        }
 
-        vshaderSource = vShaderStream.str();
-        fshaderSource = fShaderStream.str();
+        size_t open = line.find('"', directive);
+        size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+        if (close == std::string::npos){
+            std::cerr << name << "::ERROR::SHADER::MALFORMED_INCLUDE: " << path.string() << ":" << lineNumber << std::endl;
+            out += "\n";
+            continue;
+        }
 
-    } catch (const std::exception &e) {
-        std::cerr << this->name << "::ERROR::SHADER::FILE_NOT_READ_SUCCESFULLY: " << e.what() << '\n';
+        std::filesystem::path includePath = (path.parent_path() / line.substr(open + 1, close - open - 1)).lexically_normal();
+        if (included.insert(includePath).second){
+            int includeNumber = ++fileCount;
+            std::string content = readSource(name, includePath.string().c_str());
+            out += "#line 1 " + std::to_string(includeNumber) + "\n";
+            out += resolveIncludes(name, includePath, content, included, includeNumber, fileCount);
+        }
+        out += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileNumber) + "\n";
     }
+    return out;
+}
 
-    const char *vshaderCode = vshaderSource.c_str();
-    const char *fshaderCode = fshaderSource.c_str();
+static std::string readShaderSource(const std::string& name, const char* path){
+    std::set<std::filesystem::path> included = {std::filesystem::path(path).lexically_normal()};
+    int fileCount = 0;
+    return resolveIncludes(name, path, readSource(name, path), included, 0, fileCount);
+}
 
-    // shader objects creation
-    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+// 64-bit FNV-1a, only used to name cache entries
+static uint64_t hashString(const std::string& data, uint64_t hash = 14695981039346656037ull){
+    for (unsigned char c : data){
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+Shader::Shader(const char* _name, const char* vshaderPath, const char* fshaderPath) : name(_name) {
+    build({{GL_VERTEX_SHADER, readShaderSource(name, vshaderPath)}, {GL_FRAGMENT_SHADER, readShaderSource(name, fshaderPath)}});
+}
+
+Shader::Shader(const char* _name, const char *shaderPath, const ShaderDefines& defines) : name(_name) {
+    build({{GL_COMPUTE_SHADER, injectDefines(readShaderSource(name, shaderPath), defines)}});
+}
+
+void Shader::build(const std::vector<std::pair<unsigned int, std::string>>& sources){
     shaderProgram = glCreateProgram();
 
-    // vertex shader code compilation
-    glShaderSource(vertexShader, 1, &vshaderCode, NULL);
-    glCompileShader(vertexShader);
-    checkCompileErrors(vertexShader, "VERTEX");
+    // the key covers the final sources (defines included) and the driver that produced the binary
+    int numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats > 0 && !cacheDirectory.empty()){
+        uint64_t hash = hashString(name);
+        for (const auto& [type, source] : sources)
+            hash = hashString(std::to_string(type) + source, hash);
+        for (GLenum query : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION}){
+            const char* value = (const char*)glGetString(query);
+            hash = hashString(value ? value : "", hash);
+        }
 
-    // fragment shader code compilation
-    glShaderSource(fragmentShader, 1, &fshaderCode, NULL);
-    glCompileShader(fragmentShader);
-    checkCompileErrors(fragmentShader, "FRAGMENT");
+        std::stringstream ss;
+        ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+        cacheKey = ss.str();
 
-    // program code compilation
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
+        if (loadBinary()) return;
+    }
+
+    // cold build, the status is only queried in finalize() so the driver can compile in parallel
+    for (const auto& [type, source] : sources){
+        const char *code = source.c_str();
+        unsigned int shader = glCreateShader(type);
+        glShaderSource(shader, 1, &code, NULL);
+        glCompileShader(shader);
+        glAttachShader(shaderProgram, shader);
+        stages.push_back({shader, type});
+    }
+    if (!cacheKey.empty())
+        glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(shaderProgram);
-    glValidateProgram(shaderProgram);
+    pending = true;
+}
+
+void Shader::finalize(){
+    if (!pending) return;
+    pending = false;
+
+    for (const auto& [shader, type] : stages){
+        const char* stage = type == GL_VERTEX_SHADER ? "VERTEX" : type == GL_FRAGMENT_SHADER ? "FRAGMENT" : "COMPUTE";
+        checkCompileErrors(shader, stage);
+    }
     checkCompileErrors(shaderProgram, "PROGRAM");
 
     // cleanup of shaders
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    for (const auto& [shader, type] : stages){
+        glDetachShader(shaderProgram, shader);
+        glDeleteShader(shader);
+    }
+    stages.clear();
+
+    int success;
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (success) saveBinary();
 }
 
-Shader::Shader(const char* _name, const char *shaderPath) : name(_name) {
-    std::ifstream shaderFile;
-    std::string shaderSource;
+bool Shader::loadBinary(){
+    std::ifstream file(cacheDirectory + "/" + cacheKey + ".bin", std::ios::binary);
+    if (!file) return false;
 
-    shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try {
-        shaderFile.open(shaderPath);
+    GLenum format;
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (binary.size() <= sizeof(format)) return false;
+    std::memcpy(&format, binary.data(), sizeof(format));
 
-        std::stringstream shaderStream;
-        shaderStream << shaderFile.rdbuf();
-        shaderFile.close();
+    // the driver rejects binaries it did not produce, e.g. after an update
+    glProgramBinary(shaderProgram, format, binary.data() + sizeof(format), binary.size() - sizeof(format));
+    int success;
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    return success;
+}
 
-        shaderSource = shaderStream.str();
+void Shader::saveBinary(){
+    if (cacheKey.empty()) return;
 
-    } catch (const std::exception &e) {
-        std::cerr << this->name << "::ERROR::SHADER::FILE_NOT_READ_SUCCESFULLY: " << e.what() << '\n';
+    int length = 0;
+    glGetProgramiv(shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    GLenum format;
+    std::vector<char> binary(length);
+    glGetProgramBinary(shaderProgram, length, NULL, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+    std::ofstream file(cacheDirectory + "/" + cacheKey + ".bin", std::ios::binary | std::ios::trunc);
+    if (!file){
+        std::cerr << this->name << "::WARNING::SHADER::BINARY_CACHE_NOT_WRITABLE: " << cacheDirectory << std::endl;
+        return;
     }
+    file.write((const char*)&format, sizeof(format));
+    file.write(binary.data(), length);
+}
 
-    const char *shaderCode = shaderSource.c_str();
+void Shader::enableParallelCompile(){
+    if (GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    else if (GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+}
 
-    // shader objects creation
-    unsigned int shader = glCreateShader(GL_COMPUTE_SHADER);
-    shaderProgram = glCreateProgram();
+std::string Shader::injectDefines(const std::string& source, const ShaderDefines& defines){
+    if (defines.empty()) return source;
 
-    // shader code compilation
-    glShaderSource(shader, 1, &shaderCode, NULL);
-    glCompileShader(shader);
-    checkCompileErrors(shader, "COMPUTE");
+    size_t version = source.find("#version");
+    size_t insertAt = version == std::string::npos ? 0 : source.find('\n', version);
+    insertAt = insertAt == std::string::npos ? source.size() : insertAt + 1;
 
-    // program code compilation
-    glAttachShader(shaderProgram, shader);
-    glLinkProgram(shaderProgram);
-    glValidateProgram(shaderProgram);
-    checkCompileErrors(shaderProgram, "PROGRAM");
+    // keep the line numbers of compile errors pointing at the file
+    int line = 1 + std::count(source.begin(), source.begin() + insertAt, '\n');
 
-    // cleanup of shaders
-    glDeleteShader(shader);
+    std::string block;
+    for (const auto& [define, value] : defines)
+        block += "#define " + define + " " + value + "\n";
+    block += "#line " + std::to_string(line) + "\n";
+
+    return source.substr(0, insertAt) + block + source.substr(insertAt);
 }
 
+std::string Shader::floatLiteral(float value){
+    std::ostringstream ss;
+    ss.imbue(std::locale::classic());
+    ss << std::setprecision(9) << value;
+    std::string literal = ss.str();
+    if (literal.find_first_of(".eEn") == std::string::npos) literal += ".0";
+    return literal;
+}
+
+Shader* ShaderCache::get(const char* name, const char* shaderPath, const ShaderDefines& defines){
+    std::string key = shaderPath;
+    for (const auto& [define, value] : defines)
+        key += "|" + define + "=" + value;
 
-void Shader::use() { glUseProgram(shaderProgram); }
+    auto it = variants.find(key);
+    if (it == variants.end())
+        it = variants.emplace(key, std::make_unique<Shader>(name, shaderPath, defines)).first;
+    return it->second.get();
+}
+
+void ShaderCache::finalize(){
+    for (auto& [key, shader] : variants) shader->finalize();
+}
+
+void Shader::use() {
+    finalize();
+    glUseProgram(shaderProgram);
+}
 
 Shader::~Shader() { glDeleteProgram(shaderProgram); }
 void Shader::checkCompileErrors(unsigned int shader, const char* type) {
     int success;
     char infoLog[1024];
 
-    if (type != "PROGRAM") {
+    if (std::strcmp(type, "PROGRAM") != 0) {
         glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
         if (!success) {
             glGetShaderInfoLog(shader, 1024, NULL, infoLog);
@@ -151,6 +286,10 @@ void Shader::setInt(const char* attribName, int value) const {
     glUniform1i(glGetUniformLocation(shaderProgram, attribName), value);
 }
 
+void Shader::setUInt(const char* attribName, unsigned int value) const {
+    glUniform1ui(glGetUniformLocation(shaderProgram, attribName), value);
+}
+
 void Shader::setMat4(const char* attribName, glm::mat4 &value) const{
     glUniformMatrix4fv(glGetUniformLocation(shaderProgram, attribName), 1, GL_FALSE, glm::value_ptr(value));
 }
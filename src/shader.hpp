@@ -3,12 +3,22 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+/**
+ * @brief Preprocessor defines injected after the #version line, name -> value
+ */
+using ShaderDefines = std::map<std::string, std::string>;
+
 /**
  * @class Shader
  * @brief A class to manage OpenGL shader programs.
@@ -22,6 +32,28 @@ class Shader
 private:
     std::string name;
     unsigned int shaderProgram;
+
+    // compiled from source but not checked yet, see finalize()
+    bool pending = false;
+    std::vector<std::pair<unsigned int, unsigned int>> stages; // (shader, type)
+    std::string cacheKey; // empty when program binaries are not available
+
+    /**
+     * @brief Create the program from a binary cache entry, or start compiling the sources
+     * 
+     * @param sources (shader type, final source) for each stage
+     */
+    void build(const std::vector<std::pair<unsigned int, std::string>>& sources);
+
+    /**
+     * @brief Load the program from the binary cache, false if missing or rejected by the driver
+     */
+    bool loadBinary();
+
+    /**
+     * @brief Store the linked program in the binary cache
+     */
+    void saveBinary();
     /**
      * @brief Checks and prints any compile or link errors.
      * 
@@ -30,6 +62,11 @@ private:
      */
     void checkCompileErrors(unsigned int shader, const char* type);
     void checkIfAttributeExists(const char* name) const;
+
+    /**
+     * @brief Insert the defines right after the #version directive of the source
+     */
+    static std::string injectDefines(const std::string& source, const ShaderDefines& defines);
 public:
     /**
      * @brief Constructor for the shader class
@@ -45,8 +82,9 @@ public:
      * 
      * @param name The name of the shader
      * @param shaderPath Path to the compute shader file
+     * @param defines Compile-time constants to specialize the shader with
      */
-    Shader(const char* name, const char* shaderPath);
+    Shader(const char* name, const char* shaderPath, const ShaderDefines& defines = {});
     
     /**
      * @brief Default constructor for the Shader class.
@@ -63,6 +101,24 @@ public:
      */
     void use();
 
+    /**
+     * @brief Wait for a cold compile to finish, report errors and store the binary in the cache
+     * 
+     * Called by use(), creating several programs before the first use lets the driver compile
+     * them concurrently.
+     */
+    void finalize();
+
+    /**
+     * @brief Directory of the program binary cache, empty disables the cache
+     */
+    static std::string cacheDirectory;
+
+    /**
+     * @brief Let the driver compile on as many threads as it likes (KHR_parallel_shader_compile)
+     */
+    static void enableParallelCompile();
+
     /**
      * @brief set name of the shader
      */
@@ -113,6 +169,14 @@ public:
      */
     void setInt(const char* attribName, int value) const;
 
+    /**
+     * @brief set the value of a uint in the shader program.
+     * 
+     * @param attribName The name of the uniform variable.
+     * @param value The value of the uniform variable.
+     */
+    void setUInt(const char* attribName, unsigned int value) const;
+
     /**
      * @brief set the value of a mat4 in the shader program
      * 
@@ -137,4 +201,37 @@ public:
      * @param value The value of the uniform variable
      */
     void setFloat(const char* attribName, float value) const;
+
+    /**
+     * @brief Format a float as a GLSL float literal without losing precision
+     */
+    static std::string floatLiteral(float value);
+};
+
+/**
+ * @class ShaderCache
+ * @brief Owns specialized compute program variants, keyed by their source path and define set
+ * 
+ * Requesting the same path with the same defines returns the already compiled program.
+ */
+class ShaderCache
+{
+private:
+    std::map<std::string, std::unique_ptr<Shader>> variants;
+
+public:
+    /**
+     * @brief Get the compute program for path specialized with defines, compiling it on first use
+     */
+    Shader* get(const char* name, const char* shaderPath, const ShaderDefines& defines);
+
+    /**
+     * @brief Finish compiling every variant, reporting errors at once instead of at first use
+     */
+    void finalize();
+
+    /**
+     * @brief Number of distinct variants compiled so far
+     */
+    size_t size() const { return variants.size(); }
 };
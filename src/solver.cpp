@@ -13,55 +13,572 @@ Solver::Solver(Particles *_particles, float viewport_width, float viewport_heigh
         glm::vec3(0.0, 1.0, 0.0)
     };
 
-    Solver::PARTICLE_MASS = 1.0f;
+    // a wall particle stands for the area of its spacing, so the packed layers weigh as much per
+    // area as the fluid and a particle at the wall sees its rest density rather than about double
+    PARTICLE_MASS = 1.0f;
+    BOUNDARY_MASS = PARTICLE_MASS * (BOUNDARY_SPACING / PARTICLE_SPACING) * (BOUNDARY_SPACING / PARTICLE_SPACING);
 
-    glDispatchCompute(num_operations, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);PARTICLE_MASS = 1.0f;
+    num_operations = (particles->num_particles + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    
+    // offset tables and radix passes depend on the cells and their keys
+    ResizeGrid();
+
+    glGenBuffers(1, &particles->sortScratchSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->sortScratchSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, particles->spatialIndices.size() * sizeof(int), NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::SORT_SCRATCH, particles->sortScratchSSBO);
+
+    glGenBuffers(1, &particles->radixHistogramSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->radixHistogramSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, num_operations * (1 << RADIX_BITS) * sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::RADIX_HISTOGRAM, particles->radixHistogramSSBO);
+
+    // incremental resort plan and changed entries, the counters start at zero
+    std::vector<unsigned int> plan(15, 0);
+    glGenBuffers(1, &particles->sortPlanSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->sortPlanSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, plan.size() * sizeof(unsigned int), plan.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::SORT_PLAN, particles->sortPlanSSBO);
+
+    glGenBuffers(1, &particles->changedListSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->changedListSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, FIXUP_CAPACITY * 3 * sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::CHANGED_LIST, particles->changedListSSBO);
+
+    glGenBuffers(2, sortReadback.buffers);
+    for (unsigned int buffer : sortReadback.buffers){
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, 4 * sizeof(unsigned int), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    // Verlet lists, the state starts with no displacement and zero counters
+    std::vector<unsigned int> verletState(12, 0);
+    glGenBuffers(1, &particles->verletStateSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->verletStateSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, verletState.size() * sizeof(unsigned int), verletState.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::VERLET_STATE, particles->verletStateSSBO);
+
+    ResizeVerletLists();
+
+    glGenBuffers(1, &particles->numNeighboursSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->numNeighboursSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, particles->num_particles * sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::VERLET_COUNT, particles->numNeighboursSSBO);
+
+    glGenBuffers(1, &particles->verletBuildPositionSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->verletBuildPositionSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, particles->num_particles * 2 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::VERLET_BUILD_POSITION, particles->verletBuildPositionSSBO);
+
+    // cell blocks, at most one per particle
+    glGenBuffers(1, &particles->cellListSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->cellListSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (3 + particles->num_particles) * sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::CELL_LIST, particles->cellListSSBO);
+
+    glGenBuffers(2, verletReadback.buffers);
+    for (unsigned int buffer : verletReadback.buffers){
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, 2 * sizeof(unsigned int), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    // neighbour counters, zeroed here and after every read back
+    std::vector<unsigned int> neighbourCounts(3 + NEIGHBOUR_BINS, 0);
+    glGenBuffers(1, &particles->neighbourCountsSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->neighbourCountsSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, neighbourCounts.size() * sizeof(unsigned int), neighbourCounts.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::NEIGHBOUR_COUNTS, particles->neighbourCountsSSBO);
+
+    glGenBuffers(2, neighbourReadback.buffers);
+    for (unsigned int buffer : neighbourReadback.buffers){
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, neighbourCounts.size() * sizeof(unsigned int), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    SetupBoundaryParticles();
+
+    QuerySubgroupSupport();
+    LoadShaders();
+    BuildPassGraph();
+}
+
+void Solver::QuerySubgroupSupport(){
+    subgroupSupport = SubgroupSupport();
+    subgroupSupport.extension = GLEW_KHR_shader_subgroup;
+    if (subgroupSupport.extension){
+        GLint stages = 0, features = 0;
+        glGetIntegerv(GL_SUBGROUP_SIZE_KHR, &subgroupSupport.size);
+        glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+        glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+        subgroupSupport.compute = stages & GL_COMPUTE_SHADER_BIT;
+        subgroupSupport.arithmetic = features & GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR;
+        subgroupSupport.ballot = features & GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR;
+    }
+    subgroups = subgroupSupport.compute && subgroupSupport.arithmetic && subgroupSupport.ballot;
+}
+
+void Solver::SetSubgroups(bool enabled){
+    enabled = enabled && subgroupSupport.compute && subgroupSupport.arithmetic && subgroupSupport.ballot;
+    if (enabled == subgroups) return;
+    subgroups = enabled;
+    LoadShaders();
+}
+
+void Solver::SetDeterministic(bool enabled){
+    if (enabled == deterministic) return;
+    deterministic = enabled;
+    LoadShaders();
+    incrementalSeeded = false;
+}
+
+std::string Solver::SubgroupReport() const{
+    std::string report = "Subgroups: ";
+    if (!subgroupSupport.extension) report += "GL_KHR_shader_subgroup not exposed";
+    else{
+        report += std::to_string(subgroupSupport.size) + " wide";
+        report += subgroupSupport.compute ? ", compute" : ", not in compute";
+        if (subgroupSupport.arithmetic) report += ", arithmetic";
+        if (subgroupSupport.ballot) report += ", ballot";
+    }
+    return report + (subgroups ? " -> subgroup scans and reductions" : " -> shared memory scans, per-thread atomics");
+}
+
+void Solver::LoadShaders(){
+    ShaderDefines defines = SolverDefines();
+    externForceAndIntegrateShader = shaderCache.get("External Forces", "./shaders/solver/exforce_integrate.comp", KernelDefines(defines, "External Forces"));
+    boundaryCheckShader = shaderCache.get("Boundary Check", "./shaders/solver/boundary_check.comp", KernelDefines(defines, "Boundary Check"));
+    spatialHashingSortShader = shaderCache.get("Spatial Hash", "./shaders/solver/spatial_hash_sort.comp", KernelDefines(defines, "Spatial Hash"));
+    bitonicMergeSortShader = shaderCache.get("Bitonic Merge Sort", "./shaders/solver/bitonic_merge_sort.comp", KernelDefines(defines, "Bitonic Merge Sort"));
+    radixHistogramShader = shaderCache.get("Radix Histogram", "./shaders/solver/radix_histogram.comp", defines);
+    radixScanShader = shaderCache.get("Radix Scan", "./shaders/solver/radix_scan.comp", defines);
+    radixScatterShader = shaderCache.get("Radix Scatter", "./shaders/solver/radix_scatter.comp", defines);
+    incrementalRehashShader = shaderCache.get("Incremental Rehash", "./shaders/solver/incremental_rehash.comp", defines);
+    incrementalPlanShader = shaderCache.get("Incremental Plan", "./shaders/solver/incremental_plan.comp", defines);
+    incrementalMergeShader = shaderCache.get("Incremental Merge", "./shaders/solver/incremental_merge.comp", defines);
+    incrementalApplyShader = shaderCache.get("Incremental Apply", "./shaders/solver/incremental_apply.comp", defines);
+    verletCheckShader = shaderCache.get("Verlet Check", "./shaders/solver/verlet_check.comp", defines);
+    integrateHashShader = shaderCache.get("Integrate Hash", "./shaders/solver/exforce_integrate.comp", WithDefine(KernelDefines(defines, "Integrate Hash"), "FUSED_HASH"));
+
+    // compile every traversal up front so switching at runtime does not stall on the driver
+    NeighbourTraversal current = traversal;
+    for (NeighbourTraversal variant : {NeighbourTraversal::CELLS, NeighbourTraversal::VERLET, NeighbourTraversal::TILED, NeighbourTraversal::GLOBAL}){
+        traversal = variant;
+        SelectVariants();
+    }
+    traversal = current;
+    SelectVariants();
+    shaderCache.finalize();
+}
+
+float Solver::CellSize(float radius) const{
+    switch (searchStencil){
+        case SearchStencil::FINE_5X5: return 0.5f * radius;
+        case SearchStencil::QUADRANT_2X2: return 2.0f * radius;
+        default: return radius;
+    }
+}
+
+glm::ivec2 Solver::CellOf(glm::vec2 position) const{
+    int x = (int)(position.x / grid_dx);
+    int y = (int)(position.y / grid_dx);
+    return glm::ivec2(std::clamp(x, 1, (int)grid_width - 2), std::clamp(y, 1, (int)grid_height - 2));
+}
+
+void Solver::SearchRange(glm::vec2 position, glm::ivec2& lo, glm::ivec2& hi) const{
+    glm::ivec2 cell = CellOf(position);
+    if (searchStencil == SearchStencil::QUADRANT_2X2){
+        glm::vec2 local = position / grid_dx - glm::vec2(cell);
+        lo = cell - glm::ivec2(local.x < 0.5f, local.y < 0.5f);
+        hi = lo + 1;
+    } else {
+        int reach = searchStencil == SearchStencil::FINE_5X5 ? 2 : 1;
+        lo = cell - reach;
+        hi = cell + reach;
+    }
+    lo = glm::max(lo, glm::ivec2(0));
+    hi = glm::min(hi, glm::ivec2(grid_width - 1, grid_height - 1));
+}
+
+size_t Solver::CellKey(int x, int y) const{
+    if (cellKeys == CellKeys::ROW_MAJOR) return x + y * grid_width;
+
+    // interleave the bits, x in the even and y in the odd positions
+    size_t key = 0;
+    for (int bit = 0; bit < 16; bit++){
+        key |= (size_t)((x >> bit) & 1) << (2 * bit);
+        key |= (size_t)((y >> bit) & 1) << (2 * bit + 1);
+    }
+    return key;
+}
 
-    grid_width = (size_t)std::ceil(VIEWPORT_WIDTH / smoothing_length);
-    grid_height = (size_t)std::ceil(VIEWPORT_HEIGHT / smoothing_length);
+void Solver::ResizeGrid(){
+    grid_dx = CellSize(smoothing_length);
+    grid_width = (size_t)std::ceil(VIEWPORT_WIDTH / grid_dx);
+    grid_height = (size_t)std::ceil(VIEWPORT_HEIGHT / grid_dx);
     grid_size = grid_width * grid_height;
     grid.resize(grid_size);
 
-    num_operations = (particles->num_particles + 255)/ 256;
-    
-    // resize spatialOffsets
-    particles->spatialOffsets.resize(grid_size);
+    // both orders grow with x and y, so the far corner has the largest key
+    key_space = CellKey(grid_width - 1, grid_height - 1) + 1;
 
-    // set the SSBO for spatial offsets
-    glGenBuffers(1, &particles->spatialOffsetSSBO);
+    particles->spatialOffsets.assign(key_space, -1);
+    if (!particles->spatialOffsetSSBO) glGenBuffers(1, &particles->spatialOffsetSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->spatialOffsetSSBO);
     glBufferData(GL_SHADER_STORAGE_BUFFER, particles->spatialOffsets.size() * sizeof(int), particles->spatialOffsets.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particles->spatialOffsetSSBO);
-
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::SPATIAL_OFFSET, particles->spatialOffsetSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    
-    externForceAndIntegrateShader = new Shader("External Forces", "./shaders/solver/exforce_integrate.comp");
-    boundaryCheckShader = new Shader("Boundary Check", "./shaders/solver/boundary_check.comp");
-    spatialHashingSortShader = new Shader("Spatial Hash", "./shaders/solver/spatial_hash_sort.comp");
-    bitonicMergeSortShader = new Shader("Bitonic Merge Sort", "./shaders/solver/bitonic_merge_sort.comp");
-    resetOffsetsShader = new Shader("Reset Offsets", "./shaders/solver/reset_offsets.comp");
-    spatialOffsetShader = new Shader("Spatial Offsets", "./shaders/solver/spatial_offsets.comp");
-    pressureSolveShader = new Shader("Pressure Solve", "./shaders/solver/pressure_solve.comp");
-    projectionCorrectionShader = new Shader("Projection Correction", "./shaders/solver/projection_correction.comp");
+
+    // radix sort, one pass per RADIX_BITS of the largest hash
+    int keyBits = 0;
+    while (((size_t)1 << keyBits) < key_space) keyBits++;
+    radixPasses = (keyBits + RADIX_BITS - 1) / RADIX_BITS;
+}
+
+ShaderDefines Solver::SolverDefines() const{
+    ShaderDefines defines = {
+        {"LOCAL_SIZE", std::to_string(WORKGROUP_SIZE)},
+        {"SMOOTHING_LENGTH", Shader::floatLiteral(smoothing_length)},
+        {"CELL_SIZE", Shader::floatLiteral(grid_dx)},
+        {"SEARCH_REACH", searchStencil == SearchStencil::FINE_5X5 ? "2" : "1"},
+        {"GRID_WIDTH", std::to_string(grid_width)},
+        {"GRID_HEIGHT", std::to_string(grid_height)},
+        {"KERNEL_FACTOR", Shader::floatLiteral(KERNEL_FACTOR)},
+        {"KERNEL_NORM", Shader::floatLiteral(KERNEL_NORM)},
+        {"RADIX_BITS", std::to_string(RADIX_BITS)},
+        {"FIXUP_CAPACITY", std::to_string(FIXUP_CAPACITY)},
+        {"CELL_BLOCK", std::to_string(CELL_BLOCK)},
+        {"NEIGHBOUR_BINS", std::to_string(NEIGHBOUR_BINS)},
+        {"NEIGHBOUR_BIN_WIDTH", std::to_string(NEIGHBOUR_BIN_WIDTH)}
+    };
+    if (cellKeys == CellKeys::MORTON) defines["MORTON_KEYS"] = "1";
+    if (searchStencil == SearchStencil::QUADRANT_2X2) defines["QUADRANT_SEARCH"] = "1";
+    if (subgroups){
+        defines["SUBGROUPS"] = "1";
+        defines["SUBGROUP_SIZE"] = std::to_string(subgroupSupport.size);
+    }
+    if (deterministic) defines["DETERMINISTIC"] = "1";
+    return defines;
+}
+
+ShaderDefines Solver::VerletDefines() const{
+    // the list grid follows the skin, SetListGrid() passes it in so a new skin compiles nothing
+    ShaderDefines defines = SolverDefines();
+    defines.erase("CELL_SIZE");
+    defines.erase("GRID_WIDTH");
+    defines.erase("GRID_HEIGHT");
+    defines["LIST_GRID"] = "1";
+    defines["VERLET"] = "1";
+    return defines;
+}
+
+void Solver::SetListGrid(Shader* shader) const{
+    float cellSize = CellSize(smoothing_length + verletSkin);
+    shader->setFloat("verletSkin", verletSkin);
+    shader->setFloat("listCellSize", cellSize);
+    shader->setInt("listGridWidth", (int)std::ceil(VIEWPORT_WIDTH / cellSize));
+    shader->setInt("listGridHeight", (int)std::ceil(VIEWPORT_HEIGHT / cellSize));
+}
+
+const std::vector<std::string>& Solver::TunableKernels(){
+    static const std::vector<std::string> kernels = {
+        "External Forces", "Integrate Hash", "Spatial Hash", "Bitonic Merge Sort",
+        "Pressure Solve", "Projection Correction", "Correct Boundary", "Boundary Check"
+    };
+    return kernels;
+}
+
+int Solver::LocalSize(const std::string& kernel) const{
+    auto it = localSizes.find(kernel);
+    return it == localSizes.end() ? WORKGROUP_SIZE : it->second;
+}
+
+unsigned int Solver::Groups(size_t items, const std::string& kernel) const{
+    size_t size = LocalSize(kernel);
+    return (items + size - 1) / size;
+}
+
+ShaderDefines Solver::KernelDefines(ShaderDefines defines, const std::string& kernel) const{
+    defines["LOCAL_SIZE"] = std::to_string(LocalSize(kernel));
+    return defines;
+}
+
+bool Solver::LocalSizePinned(const std::string& kernel) const{
+    return traversal == NeighbourTraversal::CELLS
+        && (kernel == "Pressure Solve" || kernel == "Projection Correction" || kernel == "Correct Boundary");
+}
+
+void Solver::SetLocalSize(const std::string& kernel, int size){
+    if (size > 0) localSizes[kernel] = size;
+    else localSizes.erase(kernel);
+    LoadShaders();
+}
+
+ShaderDefines Solver::WithDefine(ShaderDefines defines, const char* define){
+    defines[define] = "1";
+    return defines;
+}
+
+void Solver::SelectVariants(){
+    ShaderDefines defines = SolverDefines();
+    ShaderDefines binningDefines = defines;
+    if (traversal == NeighbourTraversal::TILED) defines["TILED"] = "1";
+    if (traversal == NeighbourTraversal::VERLET) defines["VERLET"] = "1";
+    if (traversal == NeighbourTraversal::CELLS){
+        defines["CELL_CENTRIC"] = "1";
+        binningDefines["CELL_LIST"] = "1";
+    }
+
+    // the cell-centric kernels run one block of CELL_BLOCK particles per workgroup
+    auto neighbourDefines = [&](const char* kernel){
+        ShaderDefines kernelDefines = KernelDefines(defines, kernel);
+        if (LocalSizePinned(kernel)) kernelDefines["LOCAL_SIZE"] = std::to_string(CELL_BLOCK);
+        return kernelDefines;
+    };
+
+    // the cell-centric kernels need the binning to list the non-empty cells
+    resetOffsetsShader = shaderCache.get("Reset Offsets", "./shaders/solver/reset_offsets.comp", binningDefines);
+    spatialOffsetShader = shaderCache.get("Spatial Offsets", "./shaders/solver/spatial_offsets.comp", binningDefines);
+
+    pressureSolveShader = shaderCache.get("Pressure Solve", "./shaders/solver/pressure_solve.comp", neighbourDefines("Pressure Solve"));
+    projectionCorrectionShader = shaderCache.get("Projection Correction", "./shaders/solver/projection_correction.comp", neighbourDefines("Projection Correction"));
+    correctBoundaryShader = shaderCache.get("Correct Boundary", "./shaders/solver/projection_correction.comp", WithDefine(neighbourDefines("Correct Boundary"), "BOUNDARY_CHECK"));
+
+    // the list binning runs on its own grid
+    ShaderDefines verletDefines = VerletDefines();
+    verletPlanShader = shaderCache.get("Verlet Plan", "./shaders/solver/verlet_plan.comp", verletDefines);
+    verletHashShader = shaderCache.get("Verlet Hash", "./shaders/solver/spatial_hash_sort.comp", verletDefines);
+    verletBuildShader = shaderCache.get("Verlet Build", "./shaders/solver/verlet_build.comp", verletDefines);
+}
+
+void Solver::BuildPassGraph(){
+    using namespace Binding;
+    const uint32_t neighbourSearch = BindingMask({SPATIAL_INDEX, SPATIAL_OFFSET, BOUNDARY_POSITION, BOUNDARY_INDEX, BOUNDARY_OFFSET, VERLET_LIST, VERLET_COUNT, CELL_LIST});
+    auto binning = [this]{ return traversal != NeighbourTraversal::VERLET; };
+    auto sortedBy = [this](SortAlgorithm algorithm){ return [this, algorithm]{ return sortAlgorithm == algorithm && traversal != NeighbourTraversal::VERLET; }; };
+
+    passGraph.AddPass({"External Forces", BindingMask({POSITION, VELOCITY}), BindingMask({POSITION, VELOCITY, PREVIOUS_POSITION}),
+        [this]{ ExForcesIntegrate(); }, nullptr});
+    passGraph.AddPass({"Spatial Hash", BindingMask({POSITION}), BindingMask({SPATIAL_INDEX}),
+        [this]{ SpatialHashingSort(); }, [this]{ return sortAlgorithm != SortAlgorithm::INCREMENTAL && traversal != NeighbourTraversal::VERLET; }});
+    passGraph.AddPass({"Bitonic Merge Sort", BindingMask({SPATIAL_INDEX}), BindingMask({SPATIAL_INDEX}),
+        [this]{ BitonicMergeSort(); }, sortedBy(SortAlgorithm::BITONIC)});
+    passGraph.AddPass({"Radix Sort", BindingMask({SPATIAL_INDEX}), BindingMask({SPATIAL_INDEX, SORT_SCRATCH, RADIX_HISTOGRAM}),
+        [this]{ RadixSort(); }, sortedBy(SortAlgorithm::RADIX)});
+    passGraph.AddPass({"Incremental Sort", BindingMask({POSITION, SPATIAL_INDEX}), BindingMask({SPATIAL_INDEX, SORT_SCRATCH, SORT_PLAN, CHANGED_LIST}),
+        [this]{ IncrementalSort(); }, sortedBy(SortAlgorithm::INCREMENTAL)});
+    passGraph.AddPass({"Verlet Check", BindingMask({POSITION, VERLET_BUILD_POSITION, VERLET_STATE}), BindingMask({VERLET_STATE}),
+        [this]{ VerletCheck(); }, [this]{ return traversal == NeighbourTraversal::VERLET; }});
+    passGraph.AddPass({"Verlet Rebuild", BindingMask({POSITION, VERLET_STATE}),
+        BindingMask({SPATIAL_INDEX, SPATIAL_OFFSET, VERLET_LIST, VERLET_COUNT, VERLET_BUILD_POSITION, NEIGHBOUR_COUNTS}),
+        [this]{ VerletRebuild(); }, [this]{ return traversal == NeighbourTraversal::VERLET; }});
+    passGraph.AddPass({"Reset Offsets", 0, BindingMask({SPATIAL_OFFSET, CELL_LIST}),
+        [this]{ ResetOffsets(); }, binning});
+    passGraph.AddPass({"Spatial Offsets", BindingMask({SPATIAL_INDEX, CELL_LIST}), BindingMask({SPATIAL_OFFSET, CELL_LIST}),
+        [this]{ SpatialOffsets(); }, binning});
+    passGraph.AddPass({"Pressure Solve", BindingMask({POSITION}) | neighbourSearch, BindingMask({PRESSURE, PV, NEIGHBOUR_COUNTS}),
+        [this]{ PressureSolve(); }, nullptr});
+    // the correction writes the output buffers, and the swap after it rebinds them as POSITION and VELOCITY
+    const uint32_t correctionWrites = BindingMask({POSITION, VELOCITY, POSITION_OUT, VELOCITY_OUT});
+    passGraph.AddPass({"Projection Correction", BindingMask({POSITION, VELOCITY, PREVIOUS_POSITION, PRESSURE, PV}) | neighbourSearch, correctionWrites,
+        [this]{ ProjectionCorrection(); }, nullptr});
+    passGraph.AddPass({"Boundary Check", BindingMask({POSITION, VELOCITY}), BindingMask({VELOCITY}),
+        [this]{ BoundaryCheck(); }, nullptr});
+
+    // fused variants save a full pass over the particle arrays and a barrier each
+    passGraph.AddFusion("External Forces", "Spatial Hash", {"Integrate Hash",
+        BindingMask({POSITION, VELOCITY}), BindingMask({POSITION, VELOCITY, PREVIOUS_POSITION, SPATIAL_INDEX}),
+        [this]{ ExForcesIntegrateHash(); }, [this]{ return fusedKernels; }});
+    passGraph.AddFusion("Projection Correction", "Boundary Check", {"Correct Boundary",
+        BindingMask({POSITION, VELOCITY, PREVIOUS_POSITION, PRESSURE, PV}) | neighbourSearch, correctionWrites,
+        [this]{ ProjectionCorrectionBoundary(); }, [this]{ return fusedKernels; }});
 }
 
 Solver::~Solver(){
+    for (CounterReadback* readback : {&sortReadback, &verletReadback, &neighbourReadback})
+        for (GLsync fence : readback->fences)
+            if (fence) glDeleteSync(fence);
 }
 
 
+void Solver::SetupBoundaryParticles(){
+    auto& positions = particles->boundary_positions;
+    positions.clear();
+
+    // layers are stacked outwards from each wall, the horizontal walls also cover the corners
+    float margin = (BOUNDARY_LAYERS - 1) * BOUNDARY_SPACING;
+    for (int layer = 0; layer < BOUNDARY_LAYERS; layer++){
+        float offset = layer * BOUNDARY_SPACING;
+        for (float x = -margin; x <= VIEWPORT_WIDTH + margin; x += BOUNDARY_SPACING){
+            positions.insert(positions.end(), {x, -offset});
+            positions.insert(positions.end(), {x, VIEWPORT_HEIGHT + offset});
+        }
+        for (float y = BOUNDARY_SPACING; y < VIEWPORT_HEIGHT; y += BOUNDARY_SPACING){
+            positions.insert(positions.end(), {-offset, y});
+            positions.insert(positions.end(), {VIEWPORT_WIDTH + offset, y});
+        }
+    }
+    size_t num_boundary = positions.size() / 2;
+    particles->num_boundary_particles = num_boundary;
+
+    // bin exactly like spatial_hash_sort.comp, then sort by hash
+    auto& spatialIndices = particles->boundarySpatialIndices;
+    spatialIndices.resize(num_boundary * 2);
+    std::vector<glm::ivec2> entries(num_boundary);
+    for (size_t i = 0; i < num_boundary; i++){
+        glm::ivec2 cell = CellOf(glm::vec2(positions[2 * i], positions[2 * i + 1]));
+        entries[i] = glm::ivec2(i, CellKey(cell.x, cell.y));
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const glm::ivec2& a, const glm::ivec2& b){ return a.y < b.y; });
+
+    auto& spatialOffsets = particles->boundarySpatialOffsets;
+    spatialOffsets.assign(key_space, -1);
+    for (size_t i = 0; i < num_boundary; i++){
+        spatialIndices[2 * i] = entries[i].x;
+        spatialIndices[2 * i + 1] = entries[i].y;
+        if (i == 0 || entries[i].y != entries[i - 1].y)
+            spatialOffsets[entries[i].y] = i;
+    }
+
+    if (!particles->boundaryPositionSSBO) glGenBuffers(1, &particles->boundaryPositionSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->boundaryPositionSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, positions.size() * sizeof(float), positions.data(), GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::BOUNDARY_POSITION, particles->boundaryPositionSSBO);
+
+    if (!particles->boundarySpatialIndexSSBO) glGenBuffers(1, &particles->boundarySpatialIndexSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->boundarySpatialIndexSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, spatialIndices.size() * sizeof(int), spatialIndices.data(), GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::BOUNDARY_INDEX, particles->boundarySpatialIndexSSBO);
+
+    if (!particles->boundarySpatialOffsetSSBO) glGenBuffers(1, &particles->boundarySpatialOffsetSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->boundarySpatialOffsetSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, spatialOffsets.size() * sizeof(int), spatialOffsets.data(), GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::BOUNDARY_OFFSET, particles->boundarySpatialOffsetSSBO);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
 void Solver::Update(){
+    passGraph.BeginFrame();
     for (int i = 0; i < SOLVER_STEPS; i++){
-        ExForcesIntegrate();
-        SpatialHashingSort();
-        BitonicMergeSort();
-        ResetOffsets();
-        SpatialOffsets();
-        PressureSolve();
-        ProjectionCorrection();
-        BoundaryCheck();
+        passGraph.Execute();
+    }
+    passGraph.EndFrame();
+
+    // the kernels always count, counters nobody looks at are only cleared
+    if (sortAlgorithm == SortAlgorithm::INCREMENTAL) CollectSortStats(statsReadback);
+    if (traversal == NeighbourTraversal::VERLET) CollectVerletStats(statsReadback);
+    if (CollectNeighbourStats(statsReadback || adaptiveCaps) && adaptiveCaps) AdaptNeighbourCaps();
+}
+
+bool Solver::ReadCountersLate(unsigned int source, GLintptr offset, GLsizeiptr size, CounterReadback& readback, bool wanted, unsigned int* counters){
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // poll the older pool first so the newer one wins, a zero timeout never blocks but flushes
+    // so the fence is sure to signal
+    bool ready = false;
+    for (size_t k = 0; k < 2; k++){
+        size_t pool = (readback.next + k) % 2;
+        GLsync& fence = readback.fences[pool];
+        if (!fence) continue;
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffers[pool]);
+        glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, size, counters);
+        glDeleteSync(fence);
+        fence = nullptr;
+        readback.readGeneration = readback.generations[pool];
+        ready = true;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, source);
+    size_t pool = readback.next;
+    if (wanted && !readback.fences[pool]){
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffers[pool]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, size);
+        readback.fences[pool] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readback.generations[pool] = readback.generation;
+        readback.next = 1 - pool;
+    }
+    glClearBufferSubData(GL_COPY_READ_BUFFER, GL_R32UI, offset, size, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return ready;
+}
+
+void Solver::CollectSortStats(bool wanted){
+    // the counters sit behind the changed count, the three dispatch argument triples and fixupCount
+    unsigned int counters[4];
+    if (ReadCountersLate(particles->sortPlanSSBO, 11 * sizeof(unsigned int), sizeof(counters), sortReadback, wanted, counters))
+        sortStats = {counters[0], counters[1], counters[2], counters[3]};
+}
+
+void Solver::CollectVerletStats(bool wanted){
+    // the counters sit behind the displacement and the three dispatch argument triples
+    unsigned int counters[2];
+    if (ReadCountersLate(particles->verletStateSSBO, 10 * sizeof(unsigned int), sizeof(counters), verletReadback, wanted, counters))
+        verletStats = {counters[0], counters[1]};
+}
+
+bool Solver::CollectNeighbourStats(bool wanted){
+    std::vector<unsigned int> counters(3 + NEIGHBOUR_BINS);
+    if (!ReadCountersLate(particles->neighbourCountsSSBO, 0, counters.size() * sizeof(unsigned int), neighbourReadback, wanted, counters.data()))
+        return false;
+    neighbourStats.overflow = counters[0];
+    neighbourStats.listOverflow = counters[1];
+    neighbourStats.maxCount = counters[2];
+    neighbourStats.histogram.assign(counters.begin() + 3, counters.end());
+    return true;
+}
+
+void Solver::AdaptNeighbourCaps(){
+    // the overflow counts of a frame recorded before the last resize are about the old caps
+    if (neighbourReadback.readGeneration != neighbourReadback.generation) return;
+
+    auto roundUp = [](int value){ return (value + 7) / 8 * 8; };
+    int wanted = std::clamp(roundUp((int)neighbourStats.maxCount * 5 / 4), MIN_NEIGHBOUR_CAP, MAX_NEIGHBOUR_CAP);
+    if (wanted > neighbourCap || wanted < neighbourCap / 2){
+        neighbourCap = wanted;
+        neighbourReadback.generation++;
     }
 
+    // the lists hold everything within smoothing length + skin, so scale by the area ratio
+    float ratio = (smoothing_length + verletSkin) / smoothing_length;
+    int listWanted = roundUp((int)std::ceil(neighbourCap * ratio * ratio));
+    if (neighbourStats.listOverflow > 0) listWanted = std::max(listWanted, roundUp(verletCapacity * 3 / 2));
+    listWanted = std::min(listWanted, 2 * MAX_NEIGHBOUR_CAP);
+    if (listWanted > verletCapacity || listWanted < verletCapacity / 2){
+        verletCapacity = listWanted;
+        ResizeVerletLists();
+    }
+}
+
+void Solver::ResizeVerletLists(){
+    if (!particles->verletListSSBO) glGenBuffers(1, &particles->verletListSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->verletListSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, particles->num_particles * verletCapacity * sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::VERLET_LIST, particles->verletListSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    verletDirty = true;
+    neighbourReadback.generation++;
+}
+
+void Solver::SetAdaptiveCaps(bool adaptive){
+    adaptiveCaps = adaptive;
+    if (adaptive) return;
+
+    if (neighbourCap != (int)Particles::MAX_NEIGHBOURS) neighbourReadback.generation++;
+    neighbourCap = Particles::MAX_NEIGHBOURS;
+    if (verletCapacity != 2 * (int)Particles::MAX_NEIGHBOURS){
+        verletCapacity = 2 * Particles::MAX_NEIGHBOURS;
+        ResizeVerletLists();
+    }
 }
 
 void Solver::SetGravity(glm::vec2 gravity){
@@ -76,15 +593,197 @@ void Solver::SetRestDensity(float rest_density){
     REST_DENSITY = rest_density;
 }
 
+void Solver::SetFusedKernels(bool fused){
+    fusedKernels = fused;
+}
+
+void Solver::SetNeighbourTraversal(NeighbourTraversal _traversal){
+    // the lists were not kept up to date by the other traversals
+    if (_traversal != traversal) verletDirty = true;
+    traversal = _traversal;
+    verletStats = VerletStats();
+    SelectVariants();
+}
+
+void Solver::SetVerletSkin(float skin){
+    verletSkin = std::max(skin, 0.0f);
+    verletDirty = true;
+}
+
+void Solver::SetCellKeys(CellKeys keys){
+    if (keys == cellKeys) return;
+    cellKeys = keys;
+
+    ResizeGrid();
+    SetupBoundaryParticles();
+    LoadShaders();
+
+    // both the sorted order and the lists were keyed the old way
+    incrementalSeeded = false;
+    verletDirty = true;
+}
+
+void Solver::SetSearchStencil(SearchStencil stencil){
+    if (stencil == searchStencil) return;
+    searchStencil = stencil;
+
+    ResizeGrid();
+    SetupBoundaryParticles();
+    LoadShaders();
+
+    incrementalSeeded = false;
+    verletDirty = true;
+}
+
+std::vector<float> Solver::ReadPositions(){
+    std::vector<float> positions(particles->num_particles * 2);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->positionSSBO);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(float), positions.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return positions;
+}
+
+std::vector<float> Solver::ReadVelocities(){
+    std::vector<float> velocities(particles->num_particles * 2);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particles->velocitySSBO);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, velocities.size() * sizeof(float), velocities.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return velocities;
+}
+
+cpu::PairConstants Solver::CpuConstants() const{
+    cpu::PairConstants constants;
+    constants.h = smoothing_length;
+    constants.h2 = smoothing_length2;
+    constants.eta2 = cpu::ETA2;
+    constants.dt = DT;
+    constants.dt2 = DT2;
+    constants.mass = PARTICLE_MASS;
+    constants.boundaryMass = BOUNDARY_MASS;
+    constants.kernelFactor = KERNEL_FACTOR;
+    constants.kernelNorm = KERNEL_NORM;
+    constants.surfaceTension = SURFACE_TENSION;
+    constants.linearVisc = LINEAR_VISC;
+    constants.quadVisc = QUAD_VISC;
+    return constants;
+}
+
+cpu::Walls Solver::CpuWalls() const{
+    return {VIEWPORT_WIDTH, VIEWPORT_HEIGHT, Particles::radius, DT};
+}
+
+void Solver::ReadState(std::vector<float>& positions, std::vector<float>& velocities){
+    positions = ReadPositions();
+    velocities = ReadVelocities();
+}
+
+SearchStats Solver::MeasureSearch(){
+    std::vector<float> positions = ReadPositions();
+    size_t n = particles->num_particles;
+
+    // bin like the GPU does, a sorted copy of the keys gives every cell's population
+    std::vector<size_t> keys(n);
+    for (size_t i = 0; i < n; i++){
+        glm::ivec2 cell = CellOf(glm::vec2(positions[2 * i], positions[2 * i + 1]));
+        keys[i] = CellKey(cell.x, cell.y);
+    }
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b){ return keys[a] < keys[b]; });
+
+    SearchStats stats;
+    for (size_t i = 0; i < n; i++){
+        glm::vec2 position(positions[2 * i], positions[2 * i + 1]);
+        glm::ivec2 lo, hi;
+        SearchRange(position, lo, hi);
+        for (int y = lo.y; y <= hi.y; y++){
+            for (int x = lo.x; x <= hi.x; x++){
+                size_t key = CellKey(x, y);
+                auto first = std::lower_bound(order.begin(), order.end(), key, [&](size_t a, size_t k){ return keys[a] < k; });
+                for (auto it = first; it != order.end() && keys[*it] == key; it++){
+                    if (*it == i) continue;
+                    stats.candidates++;
+                    glm::vec2 diff = glm::vec2(positions[2 * *it], positions[2 * *it + 1]) - position;
+                    if (glm::length2(diff) <= smoothing_length2) stats.neighbours++;
+                }
+            }
+        }
+    }
+    stats.candidates /= n;
+    stats.neighbours /= n;
+    return stats;
+}
+
+KeyLocality Solver::MeasureKeyLocality(){
+    std::vector<float> positions = ReadPositions();
+
+    // bin and sort like the GPU does, keeping the cell of every particle
+    size_t n = particles->num_particles;
+    std::vector<glm::vec2> points(n);
+    std::vector<size_t> keys(n);
+    for (size_t i = 0; i < n; i++){
+        points[i] = glm::vec2(positions[2 * i], positions[2 * i + 1]);
+        glm::ivec2 cell = CellOf(points[i]);
+        keys[i] = CellKey(cell.x, cell.y);
+    }
+    std::vector<size_t> sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+
+    // a uvec2 entry is 8 bytes, an offset 4, so a 64 byte line holds 8 entries or 16 offsets
+    KeyLocality locality;
+    std::vector<size_t> indexLines, offsetLines;
+    size_t numGroups = 0;
+    for (size_t group = 0; group < n; group += WORKGROUP_SIZE, numGroups++){
+        indexLines.clear();
+        offsetLines.clear();
+        for (size_t i = group; i < std::min(group + WORKGROUP_SIZE, n); i++){
+            size_t minKey = SIZE_MAX, maxKey = 0;
+            glm::ivec2 lo, hi;
+            SearchRange(points[i], lo, hi);
+            for (int y = lo.y; y <= hi.y; y++){
+                for (int x = lo.x; x <= hi.x; x++){
+                    size_t key = CellKey(x, y);
+                    minKey = std::min(minKey, key);
+                    maxKey = std::max(maxKey, key);
+                    offsetLines.push_back(key / 16);
+
+                    auto first = std::lower_bound(sorted.begin(), sorted.end(), key);
+                    auto last = std::upper_bound(first, sorted.end(), key);
+                    for (auto slot = first; slot != last; slot++)
+                        indexLines.push_back((slot - sorted.begin()) / 8);
+                }
+            }
+            locality.keySpan += maxKey - minKey;
+        }
+        std::sort(indexLines.begin(), indexLines.end());
+        std::sort(offsetLines.begin(), offsetLines.end());
+        locality.indexLines += std::unique(indexLines.begin(), indexLines.end()) - indexLines.begin();
+        locality.offsetLines += std::unique(offsetLines.begin(), offsetLines.end()) - offsetLines.begin();
+    }
+    locality.indexLines /= numGroups;
+    locality.offsetLines /= numGroups;
+    locality.keySpan /= n;
+    return locality;
+}
+
+void Solver::SetSortAlgorithm(SortAlgorithm algorithm){
+    // the incremental resort needs a full sort to start from
+    if (algorithm != sortAlgorithm) incrementalSeeded = false;
+    sortAlgorithm = algorithm;
+    sortStats = SortStats();
+}
+
 
 void Solver::BoundaryCheck(){
     boundaryCheckShader->use();
     boundaryCheckShader->setFloat("dt", DT);
     boundaryCheckShader->setFloat("viewWidth", VIEWPORT_WIDTH);
+    boundaryCheckShader->setFloat("viewHeight", VIEWPORT_HEIGHT);
     boundaryCheckShader->setFloat("radius", Particles::radius);
 
-    glDispatchCompute(num_operations, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glDispatchCompute(Groups(particles->num_particles, "Boundary Check"), 1, 1);
 
 }
 
@@ -95,21 +794,16 @@ void Solver::ExForcesIntegrate(){
     externForceAndIntegrateShader->setFloat("dt", DT);
     externForceAndIntegrateShader->setFloat2v("gravity", GRAVITY.x, GRAVITY.y);
 
-    glDispatchCompute(num_operations, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glDispatchCompute(Groups(particles->num_particles, "External Forces"), 1, 1);
 
 }
 
 void Solver::SpatialHashingSort(){
     spatialHashingSortShader->use();
-    spatialHashingSortShader->setFloat("cellSize", smoothing_length);
-    spatialHashingSortShader->setInt("gridWidth", grid_width);
-    spatialHashingSortShader->setInt("gridHeight", grid_height);
-    glDispatchCompute(num_operations, 1, 1);    
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glDispatchCompute(Groups(particles->num_particles, "Spatial Hash"), 1, 1);
 }
 
-void Solver::BitonicMergeSort(){
+void Solver::BitonicMergeSort(GLintptr indirectArgs){
     bitonicMergeSortShader->use();
     bitonicMergeSortShader->setInt("numEntries", particles->num_particles);
     int numStages = (int)ceil(log2(particles->num_particles));
@@ -124,61 +818,200 @@ void Solver::BitonicMergeSort(){
                 bitonicMergeSortShader->setInt("groupWidth", groupWidth);
                 bitonicMergeSortShader->setInt("groupHeight", groupHeight);
                 bitonicMergeSortShader->setInt("stepIndex", stepIndex);
-                glDispatchCompute(1 << (numStages - 1), 1, 1);
-                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); 
+                // every step depends on the previous one, the barrier before the first is placed by the pass graph
+                if (stageIndex + stepIndex > 0) glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                // one invocation per compared pair
+                if (indirectArgs >= 0) glDispatchComputeIndirect(indirectArgs);
+                else glDispatchCompute(Groups((size_t)1 << (numStages - 1), "Bitonic Merge Sort"), 1, 1);
             }
         }
 }
 
 
-void Solver::ResetOffsets(){
-    resetOffsetsShader->use();
-    glDispatchCompute((grid_size + 255) / 256, 1, 1);
+void Solver::RadixSort(){
+    for (int pass = 0; pass < radixPasses; pass++){
+        int shift = pass * RADIX_BITS;
+
+        // the barrier before the first pass is placed by the pass graph
+        if (pass > 0) glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        radixHistogramShader->use();
+        radixHistogramShader->setInt("shift", shift);
+        glDispatchCompute(num_operations, 1, 1);
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        radixScanShader->use();
+        glDispatchCompute(1, 1, 1);
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        radixScatterShader->use();
+        radixScatterShader->setInt("shift", shift);
+        glDispatchCompute(num_operations, 1, 1);
+
+        // the scattered copy becomes the spatial index the next pass and the later stages read
+        std::swap(particles->spatialIndexSSBO, particles->sortScratchSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::SPATIAL_INDEX, particles->spatialIndexSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding::SORT_SCRATCH, particles->sortScratchSSBO);
+    }
+}
+
+
+void Solver::IncrementalSort(){
+    if (!incrementalSeeded){
+        SpatialHashingSort();
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        BitonicMergeSort();
+        incrementalSeeded = true;
+        return;
+    }
+
+    incrementalRehashShader->use();
+    glDispatchCompute(num_operations, 1, 1);
+
+    int numStages = (int)ceil(log2(particles->num_particles));
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    incrementalPlanShader->use();
+    incrementalPlanShader->setInt("entryGroups", num_operations);
+    incrementalPlanShader->setInt("bitonicGroups", Groups((size_t)1 << (numStages - 1), "Bitonic Merge Sort"));
+    glDispatchCompute(1, 1, 1);
+
+    // offsets of mergeArgs and applyArgs in the plan, see common/incremental_sort.glsl
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, particles->sortPlanSSBO);
+    incrementalMergeShader->use();
+    glDispatchComputeIndirect(1 * sizeof(unsigned int));
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    incrementalApplyShader->use();
+    glDispatchComputeIndirect(4 * sizeof(unsigned int));
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    BitonicMergeSort(7 * sizeof(unsigned int)); // bitonicArgs
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
 }
 
-void Solver::SpatialOffsets(){
-    spatialOffsetShader->use();
+void Solver::VerletCheck(){
+    verletCheckShader->use();
     glDispatchCompute(num_operations, 1, 1);
+
+    int numStages = (int)ceil(log2(particles->num_particles));
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    verletPlanShader->use();
+    SetListGrid(verletPlanShader);
+    verletPlanShader->setInt("forceRebuild", verletDirty);
+    verletPlanShader->setInt("particleGroups", num_operations);
+    verletPlanShader->setInt("gridGroups", (key_space + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE);
+    verletPlanShader->setInt("bitonicGroups", Groups((size_t)1 << (numStages - 1), "Bitonic Merge Sort"));
+    glDispatchCompute(1, 1, 1);
+    verletDirty = false;
 }
 
+void Solver::VerletRebuild(){
+    // offsets of particleArgs, gridArgs and bitonicArgs in the state, see common/verlet.glsl
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, particles->verletStateSSBO);
 
-void Solver::PressureSolve(){
-    pressureSolveShader->use();
-    pressureSolveShader->setFloat("dt", DT);
-    pressureSolveShader->setFloat("smoothing_length", smoothing_length);
-    pressureSolveShader->setInt("gridWidth", grid_width);
-    pressureSolveShader->setInt("gridHeight", grid_height);
-    pressureSolveShader->setInt("MAX_NEIGHBORS", Particles::MAX_NEIGHBOURS);
-    pressureSolveShader->setFloat("PARTICLE_MASS", PARTICLE_MASS);
-    pressureSolveShader->setFloat("KERNEL_FACTOR", KERNEL_FACTOR);
-    pressureSolveShader->setFloat("KERNEL_NORM", KERNEL_NORM);
-    pressureSolveShader->setFloat("STIFFNESS", STIFFNESS);
-    pressureSolveShader->setFloat("STIFF_APPROX", STIFF_APPROX);
-    pressureSolveShader->setFloat("REST_DENSITY", REST_DENSITY);
+    resetOffsetsShader->use();
+    glDispatchComputeIndirect(4 * sizeof(unsigned int));
+    verletHashShader->use();
+    SetListGrid(verletHashShader);
+    glDispatchComputeIndirect(1 * sizeof(unsigned int));
 
-    glDispatchCompute(num_operations, 1, 1);
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    BitonicMergeSort(7 * sizeof(unsigned int));
 
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    spatialOffsetShader->use();
+    glDispatchComputeIndirect(1 * sizeof(unsigned int));
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    verletBuildShader->use();
+    SetListGrid(verletBuildShader);
+    verletBuildShader->setUInt("verletCapacity", verletCapacity);
+    glDispatchComputeIndirect(1 * sizeof(unsigned int));
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
 }
 
-void Solver::ProjectionCorrection(){
-    projectionCorrectionShader->use();
-
-    projectionCorrectionShader->setFloat("dt", DT);
-    projectionCorrectionShader->setFloat("smoothing_length", smoothing_length);
-    projectionCorrectionShader->setInt("gridWidth", grid_width);
-    projectionCorrectionShader->setInt("gridHeight", grid_height);
-    projectionCorrectionShader->setInt("MAX_NEIGHBORS", Particles::MAX_NEIGHBOURS);
-    projectionCorrectionShader->setFloat("PARTICLE_MASS", PARTICLE_MASS);
-    projectionCorrectionShader->setFloat("KERNEL_FACTOR", KERNEL_FACTOR);
-    projectionCorrectionShader->setFloat("KERNEL_NORM", KERNEL_NORM);
-    projectionCorrectionShader->setFloat("REST_DENSITY", REST_DENSITY);
-    projectionCorrectionShader->setFloat("LINEAR_VISC", LINEAR_VISC);
-    projectionCorrectionShader->setFloat("QUAD_VISC", QUAD_VISC);
-    projectionCorrectionShader->setFloat("SURFACE_TENSION", SURFACE_TENSION);
 
+void Solver::ResetOffsets(){
+    resetOffsetsShader->use();
+    glDispatchCompute((key_space + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+}
+
+void Solver::SpatialOffsets(){
+    spatialOffsetShader->use();
     glDispatchCompute(num_operations, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+
+void Solver::DispatchNeighbourKernel(const char* kernel){
+    if (traversal != NeighbourTraversal::CELLS){
+        glDispatchCompute(Groups(particles->num_particles, kernel), 1, 1);
+        return;
+    }
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, particles->cellListSSBO);
+    glDispatchComputeIndirect(0);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
+
+void Solver::PressureSolve(){
+    Shader* shader = pressureSolveShader;
+    shader->use();
+    shader->setFloat("dt", DT);
+    shader->setFloat("PARTICLE_MASS", PARTICLE_MASS);
+    shader->setFloat("BOUNDARY_MASS", BOUNDARY_MASS);
+    shader->setFloat("STIFFNESS", STIFFNESS);
+    shader->setFloat("STIFF_APPROX", STIFF_APPROX);
+    shader->setFloat("REST_DENSITY", REST_DENSITY);
+    shader->setInt("maxNeighbors", neighbourCap);
+    shader->setUInt("verletCapacity", verletCapacity);
+
+    // the block count was written by Spatial Offsets, the pass graph only covers storage reads
+    if (traversal == NeighbourTraversal::CELLS) glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    DispatchNeighbourKernel("Pressure Solve");
+}
+
+void Solver::ProjectionCorrection(){
+    Shader* shader = projectionCorrectionShader;
+    shader->use();
+
+    shader->setFloat("dt", DT);
+    shader->setFloat("PARTICLE_MASS", PARTICLE_MASS);
+    shader->setFloat("BOUNDARY_MASS", BOUNDARY_MASS);
+    shader->setFloat("REST_DENSITY", REST_DENSITY);
+    shader->setFloat("LINEAR_VISC", LINEAR_VISC);
+    shader->setFloat("QUAD_VISC", QUAD_VISC);
+    shader->setFloat("SURFACE_TENSION", SURFACE_TENSION);
+    shader->setInt("maxNeighbors", neighbourCap);
+    shader->setUInt("verletCapacity", verletCapacity);
+
+    DispatchNeighbourKernel("Projection Correction");
+    particles->swapStateBuffers();
+}
+
+void Solver::ExForcesIntegrateHash(){
+    integrateHashShader->use();
+    integrateHashShader->setFloat("dt", DT);
+    integrateHashShader->setFloat2v("gravity", GRAVITY.x, GRAVITY.y);
+
+    glDispatchCompute(Groups(particles->num_particles, "Integrate Hash"), 1, 1);
+}
+
+void Solver::ProjectionCorrectionBoundary(){
+    correctBoundaryShader->use();
+
+    correctBoundaryShader->setFloat("dt", DT);
+    correctBoundaryShader->setFloat("PARTICLE_MASS", PARTICLE_MASS);
+    correctBoundaryShader->setFloat("BOUNDARY_MASS", BOUNDARY_MASS);
+    correctBoundaryShader->setFloat("REST_DENSITY", REST_DENSITY);
+    correctBoundaryShader->setFloat("LINEAR_VISC", LINEAR_VISC);
+    correctBoundaryShader->setFloat("QUAD_VISC", QUAD_VISC);
+    correctBoundaryShader->setFloat("SURFACE_TENSION", SURFACE_TENSION);
+    correctBoundaryShader->setFloat("viewWidth", VIEWPORT_WIDTH);
+    correctBoundaryShader->setFloat("viewHeight", VIEWPORT_HEIGHT);
+    correctBoundaryShader->setFloat("radius", Particles::radius);
+    correctBoundaryShader->setInt("maxNeighbors", neighbourCap);
+    correctBoundaryShader->setUInt("verletCapacity", verletCapacity);
+
+    DispatchNeighbourKernel("Correct Boundary");
+    particles->swapStateBuffers();
 }
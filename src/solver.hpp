@@ -6,8 +6,11 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/norm.hpp>
 #include <vector>
+#include <map>
+#include <string>
 #include <list>
 #include <algorithm>
+#include <numeric>
 #include <execution>    
 #include <memory>
 #include <cmath>
@@ -15,6 +18,130 @@
 #include <particles.hpp>
 #include <logger.hpp>
 #include <shader.hpp>
+#include <pass_graph.hpp>
+#include <cpu_reference.hpp>
+
+/**
+ * @brief How the density and correction kernels visit the neighbour cells
+ */
+enum class NeighbourTraversal
+{
+    GLOBAL, // every thread walks its cells in global memory
+    TILED,  // each workgroup stages its neighbourhood in shared memory first
+    VERLET, // every thread reads a neighbour list that is only rebuilt once it may be stale
+    CELLS   // one workgroup per block of a non-empty cell, staging the cells around it once
+};
+
+/**
+ * @brief Algorithm that orders the spatial index by cell hash
+ */
+enum class SortAlgorithm
+{
+    BITONIC,    // O(N log^2 N) compare-and-swap network
+    RADIX,      // LSD radix sort, one pass per RADIX_BITS of the largest hash
+    INCREMENTAL // rehash the previous order, merge the few entries that changed cell
+};
+
+/**
+ * @brief Order of the cell keys the spatial index is sorted by
+ */
+enum class CellKeys
+{
+    ROW_MAJOR,  // x + y * grid width, vertical neighbours are a grid row apart
+    MORTON      // x and y bits interleaved, nearby cells in 2D stay nearby in the index
+};
+
+/**
+ * @brief Cells visited by the neighbour search and how wide they are
+ */
+enum class SearchStencil
+{
+    CELLS_3X3,      // cells as wide as the smoothing length
+    FINE_5X5,       // half as wide, the stencil hugs the support circle more tightly
+    QUADRANT_2X2    // twice as wide, only the 2x2 cells towards the particle's quadrant
+};
+
+/**
+ * @brief Particles the cell search tests against how many are within the smoothing length
+ * 
+ * Averaged per particle, measured on the CPU from the current positions.
+ */
+struct SearchStats
+{
+    double candidates = 0;
+    double neighbours = 0;
+};
+
+/**
+ * @brief Cache lines the cell search touches, measured on the CPU from the current positions
+ * 
+ * Counted per workgroup of consecutive particles, lines of 64 bytes.
+ */
+struct KeyLocality
+{
+    double indexLines = 0;  // lines of the sorted spatial index
+    double offsetLines = 0; // lines of the offset table
+    double keySpan = 0;     // largest minus smallest key of a particle's cells, averaged
+};
+
+/**
+ * @brief What the incremental resort did over the latest frame's substeps
+ */
+struct SortStats
+{
+    unsigned int skipped = 0;   // no particle changed cell
+    unsigned int fixedUp = 0;   // changed entries merged into the sorted order
+    unsigned int full = 0;      // too many changes, full bitonic sort
+    unsigned int changed = 0;   // entries that changed cell, summed over the substeps
+};
+
+/**
+ * @brief Neighbour counts of the latest frame, summed over its substeps
+ */
+struct NeighbourStats
+{
+    unsigned int overflow = 0;      // particles with more neighbours than the cap
+    unsigned int listOverflow = 0;  // Verlet lists that ran out of slots
+    unsigned int maxCount = 0;      // most neighbours of any particle
+    std::vector<unsigned int> histogram; // particles per Solver::NEIGHBOUR_BIN_WIDTH neighbours
+};
+
+/**
+ * @brief How often the Verlet lists were rebuilt over the latest frame
+ */
+struct VerletStats
+{
+    unsigned int rebuilds = 0;
+    unsigned int substeps = 0;
+};
+
+/**
+ * @brief Two copies of a counter block in flight, each fenced until the GPU finished it
+ */
+struct CounterReadback
+{
+    unsigned int buffers[2] = {0, 0};
+    GLsync fences[2] = {nullptr, nullptr};
+    size_t next = 0;    // pool the next copy goes to, the older of the two
+
+    // the owner bumps generation when the counters change meaning, every copy keeps the one it
+    // was made under and readGeneration is that of the copy read last
+    unsigned int generation = 0;
+    unsigned int generations[2] = {0, 0};
+    unsigned int readGeneration = 0;
+};
+
+/**
+ * @brief What the driver reports for GL_KHR_shader_subgroup, queried once per solver
+ */
+struct SubgroupSupport
+{
+    bool extension = false;     // GL_KHR_shader_subgroup is exposed
+    int size = 0;               // invocations per subgroup
+    bool compute = false;       // subgroup operations in compute shaders
+    bool arithmetic = false;    // subgroupAdd, subgroupInclusiveAdd, ...
+    bool ballot = false;        // subgroupBallot and its bit counts
+};
 
 class Solver
 {
@@ -29,6 +156,12 @@ private:
     std::vector<glm::vec3> boundary;    
 
     friend class Logger;
+    friend class Validator;
+    friend class CpuSolver;
+
+    // the kernels' constants and walls for the CPU mirrors of the solver
+    cpu::PairConstants CpuConstants() const;
+    cpu::Walls CpuWalls() const;
 
     Logger logger;
 // Solver Parameters
@@ -44,11 +177,14 @@ private:
     constexpr static float QUAD_VISC = 0.25f;
     constexpr static float STIFFNESS = 0.08f;
     constexpr static float STIFF_APPROX = 0.1f;
+    constexpr static int BOUNDARY_LAYERS = 2;
+    constexpr static float BOUNDARY_SPACING = 2 * Point::radius;
     
     glm::vec2 GRAVITY = glm::vec2(0.0f, -9.81f);
     float SURFACE_TENSION = 1e-4;
     float REST_DENSITY = 45.0f;
     float PARTICLE_MASS;
+    float BOUNDARY_MASS;
 
     constexpr static float smoothing_length = 6 * Point::radius;
     constexpr static float smoothing_length2 = smoothing_length * smoothing_length;
@@ -64,30 +200,234 @@ private:
 private:
     constexpr static float EPS = 1e-7;
     constexpr static float EPS2 = EPS * EPS;
-    constexpr static float grid_dx = smoothing_length;
+    float grid_dx = smoothing_length;
     size_t grid_width;
     size_t grid_height;
     size_t grid_size;
+    size_t key_space;   // largest cell key + 1, the length of the offset tables
     std::vector<Point*> grid;
 
+    /**
+     * @brief Width of the cells that bin particles searched up to radius, for the current stencil
+     */
+    float CellSize(float radius) const;
+
+    /**
+     * @brief CPU twins of GetCellPos(), Hash() and SearchRange() in common/neighbour_search.glsl
+     */
+    glm::ivec2 CellOf(glm::vec2 position) const;
+    size_t CellKey(int x, int y) const;
+    void SearchRange(glm::vec2 position, glm::ivec2& lo, glm::ivec2& hi) const;
+
+    /**
+     * @brief Size the grid, the offset tables and the radix passes for the current cells and keys
+     */
+    void ResizeGrid();
+
+    /**
+     * @brief Copy the particle positions back from the GPU, stalls until the frame is done
+     */
+    std::vector<float> ReadPositions();
+    std::vector<float> ReadVelocities();
+
 private:
+    constexpr static int WORKGROUP_SIZE = 256;
     size_t num_operations;
 
+    // tuned local size per kernel, the others run WORKGROUP_SIZE
+    std::map<std::string, int> localSizes;
+
+    /**
+     * @brief Local size of a tunable kernel, by the name of its pass
+     */
+    int LocalSize(const std::string& kernel) const;
+
+    /**
+     * @brief Workgroups that cover items invocations of a tunable kernel
+     */
+    unsigned int Groups(size_t items, const std::string& kernel) const;
+
+    /**
+     * @brief defines with LOCAL_SIZE set to the kernel's local size
+     */
+    ShaderDefines KernelDefines(ShaderDefines defines, const std::string& kernel) const;
+
+    ShaderCache shaderCache;
+
     Shader* externForceAndIntegrateShader;
     Shader* boundaryCheckShader;
     Shader* spatialHashingSortShader;
     Shader* bitonicMergeSortShader;
+    Shader* radixHistogramShader;
+    Shader* radixScanShader;
+    Shader* radixScatterShader;
+    Shader* incrementalRehashShader;
+    Shader* incrementalPlanShader;
+    Shader* incrementalMergeShader;
+    Shader* incrementalApplyShader;
+    Shader* verletCheckShader;
+    Shader* verletPlanShader;
+    Shader* verletHashShader;
+    Shader* verletBuildShader;
     Shader* resetOffsetsShader;
     Shader* spatialOffsetShader;
     Shader* pressureSolveShader;
     Shader* projectionCorrectionShader;
+    Shader* integrateHashShader;
+    Shader* correctBoundaryShader;
 
+    // use the fused integrate+hash and correct+boundary kernels
+    bool fusedKernels = true;
+    NeighbourTraversal traversal = NeighbourTraversal::GLOBAL;
+    SortAlgorithm sortAlgorithm = SortAlgorithm::BITONIC;
+    CellKeys cellKeys = CellKeys::ROW_MAJOR;
+    SearchStencil searchStencil = SearchStencil::CELLS_3X3;
+
+    constexpr static int RADIX_BITS = 4;
+    int radixPasses;
+
+    // past this many changed entries the incremental resort falls back to a full sort
+    constexpr static int FIXUP_CAPACITY = 1024;
+    bool incrementalSeeded = false;
+    CounterReadback sortReadback;
+    SortStats sortStats;
+
+    /**
+     * @brief Collect the incremental resort counters, read back only when wanted
+     */
+    void CollectSortStats(bool wanted);
+
+    // neighbour list slots per particle, and the extra list radius beyond the smoothing length
+    int verletCapacity = 2 * Particles::MAX_NEIGHBOURS;
+    float verletSkin = 0.25f * smoothing_length;
+    bool verletDirty = true;
+    CounterReadback verletReadback;
+    VerletStats verletStats;
+
+    /**
+     * @brief Allocate verletCapacity slots per particle, the lists are rebuilt before their next use
+     */
+    void ResizeVerletLists();
+
+    // neighbours a particle accumulates, more are only counted
+    int neighbourCap = Particles::MAX_NEIGHBOURS;
+    bool adaptiveCaps = false;
+    CounterReadback neighbourReadback;
+    NeighbourStats neighbourStats;
+
+    // the sort, Verlet and neighbour counters are only read back for someone who shows them
+    bool statsReadback = false;
+
+    /**
+     * @brief Collect the neighbour counters, read back only when wanted
+     * 
+     * @return true when a new frame was read
+     */
+    bool CollectNeighbourStats(bool wanted);
+
+    /**
+     * @brief Size the neighbour cap and the Verlet lists from the observed neighbour counts
+     * 
+     * Grows at once to a quarter above the largest count, shrinks only once that falls below half
+     * of the cap, so the kernels are not resized every frame. Only called for a newly read frame,
+     * and frames recorded under caps it has since replaced are ignored.
+     */
+    void AdaptNeighbourCaps();
+
+    /**
+     * @brief Defines of the kernels that bin for the Verlet lists, on cells of smoothing length + skin
+     * 
+     * The skin and the grid it sizes are uniforms, set by SetListGrid(), so changing the skin
+     * reuses the same programs.
+     */
+    ShaderDefines VerletDefines() const;
+
+    /**
+     * @brief Set the skin and the list grid's cell size and dimensions on a list kernel in use
+     */
+    void SetListGrid(Shader* shader) const;
+
+    /**
+     * @brief Copy counters out of a GPU buffer and return the newest earlier copy the GPU finished
+     * 
+     * Each copy is fenced and only read once its fence signalled, polled without waiting, so the
+     * CPU never stalls on the frame in flight. A frame that finds both pools still in flight is
+     * dropped. The counters are cleared either way, and with wanted false nothing is copied.
+     * 
+     * @return true when counters holds a frame finished since the last call, recorded under
+     *         readback.readGeneration
+     */
+    bool ReadCountersLate(unsigned int source, GLintptr offset, GLsizeiptr size, CounterReadback& readback, bool wanted, unsigned int* counters);
+
+    /**
+     * @brief Collect the Verlet rebuild counters, read back only when wanted
+     */
+    void CollectVerletStats(bool wanted);
+
+    SubgroupSupport subgroupSupport;
+    bool subgroups = false;
+    bool deterministic = false;
+
+    /**
+     * @brief Query the subgroup limits, the kernels use subgroups whenever they are supported
+     */
+    void QuerySubgroupSupport();
+
+    // particles per cell-centric workgroup, cells holding more are split into blocks
+    constexpr static int CELL_BLOCK = 64;
+
+    /**
+     * @brief Dispatch a neighbour kernel, one workgroup per cell block when the traversal is cell-centric
+     */
+    void DispatchNeighbourKernel(const char* kernel);
+
+    PassGraph passGraph;
+
+    /**
+     * @brief Compile-time constants the solver kernels are specialized with
+     * 
+     * Everything that is constant for the lifetime of the solver is baked into the kernels,
+     * so the compiler can unroll and constant-fold the neighbour loops.
+     */
+    ShaderDefines SolverDefines() const;
+    static ShaderDefines WithDefine(ShaderDefines defines, const char* define);
+
+    /**
+     * @brief Fetch every kernel for the current defines and compile all traversals up front
+     */
+    void LoadShaders();
+
+    /**
+     * @brief Point the neighbour kernels at the variants of the current traversal
+     * 
+     * The tiled and fused kernels are the same sources compiled with TILED and
+     * BOUNDARY_CHECK defined, the shader cache keeps every variant alive.
+     */
+    void SelectVariants();
+
+    /**
+     * @brief Declare the substep's passes and the bindings each one reads and writes
+     */
+    void BuildPassGraph();
 
 public:
+    constexpr static int NEIGHBOUR_BINS = 32;
+    constexpr static int NEIGHBOUR_BIN_WIDTH = 4;
+    constexpr static int MIN_NEIGHBOUR_CAP = 16;
+    constexpr static int MAX_NEIGHBOUR_CAP = 256;
+
+    // spacing the scenes seed the fluid at, the wall particles are weighted to match its density
+    constexpr static float PARTICLE_SPACING = 3 * Point::radius;
+
     Solver() {}
     Solver (Particles *particles, float viewport_width, float viewport_height);
     ~Solver();
 
+    /**
+     * @brief Real time that one call to Update() stands for
+     */
+    constexpr static double FrameTime() { return 1.0 / FPS; }
+
     /**
      * @brief set value for gravity
      */
@@ -103,6 +443,172 @@ public:
      */
     void SetRestDensity(float rest_density);
 
+    /**
+     * @brief Place the static wall particles along the four boundaries and bin them
+     * 
+     * The boundary particles never move, so their spatial index and offsets are
+     * computed once here on the CPU and reused by every substep.
+     */
+    void SetupBoundaryParticles();
+
+    /**
+     * @brief Passes of a substep, with their barriers and GPU timings
+     */
+    PassGraph& GetPassGraph() { return passGraph; }
+
+    /**
+     * @brief Switch between the fused kernels and the separate passes, kept for validation
+     */
+    void SetFusedKernels(bool fused);
+
+    bool GetFusedKernels() const { return fusedKernels; }
+
+    /**
+     * @brief Select how the density and correction kernels traverse the neighbour cells
+     */
+    void SetNeighbourTraversal(NeighbourTraversal _traversal);
+
+    NeighbourTraversal GetNeighbourTraversal() const { return traversal; }
+
+    /**
+     * @brief Select the algorithm that sorts the spatial index every substep
+     */
+    void SetSortAlgorithm(SortAlgorithm algorithm);
+
+    SortAlgorithm GetSortAlgorithm() const { return sortAlgorithm; }
+
+    /**
+     * @brief Select the cell key order, rebins the boundary and swaps the kernels
+     */
+    void SetCellKeys(CellKeys keys);
+
+    CellKeys GetCellKeys() const { return cellKeys; }
+
+    /**
+     * @brief Passes whose kernels can be compiled with any local size
+     * 
+     * The kernels dispatched indirectly by the Verlet and incremental plans, the radix sort and the
+     * cell-centric kernels size their workgroups by construction and are left out.
+     */
+    static const std::vector<std::string>& TunableKernels();
+
+    /**
+     * @brief Compile a tunable kernel with the given local size, 0 restores WORKGROUP_SIZE
+     */
+    void SetLocalSize(const std::string& kernel, int size);
+
+    int GetLocalSize(const std::string& kernel) const { return LocalSize(kernel); }
+
+    /**
+     * @brief Whether the current traversal overrides a tunable kernel's local size
+     * 
+     * The cell-centric traversal runs the neighbour kernels with CELL_BLOCK invocations whatever
+     * their tuned size, which only takes effect under the other traversals.
+     */
+    bool LocalSizePinned(const std::string& kernel) const;
+
+    /**
+     * @brief Select the cells the neighbour search visits, rebins the boundary and swaps the kernels
+     */
+    void SetSearchStencil(SearchStencil stencil);
+
+    SearchStencil GetSearchStencil() const { return searchStencil; }
+
+    /**
+     * @brief Read back the positions and count the candidates the cell search tests
+     * 
+     * Stalls on the GPU, meant for picking the stencil rather than for every frame.
+     */
+    SearchStats MeasureSearch();
+
+    /**
+     * @brief Read back the positions and count the cache lines the neighbour walk touches
+     * 
+     * Stalls on the GPU, only meant for benchmarks.
+     */
+    KeyLocality MeasureKeyLocality();
+
+    /**
+     * @brief Decisions of the incremental resort in the latest frame the GPU finished, kept up
+     *        to date while SetStatsReadback() is on
+     */
+    const SortStats& GetSortStats() const { return sortStats; }
+
+    /**
+     * @brief Set the Verlet skin, the lists hold neighbours up to smoothing length + skin
+     * 
+     * A wider skin rebuilds less often but keeps longer lists.
+     */
+    void SetVerletSkin(float skin);
+
+    float GetVerletSkin() const { return verletSkin; }
+
+    constexpr static float GetSmoothingLength() { return smoothing_length; }
+
+    /**
+     * @brief Verlet list rebuilds of the latest finished frame, see SetStatsReadback()
+     */
+    const VerletStats& GetVerletStats() const { return verletStats; }
+
+    /**
+     * @brief Neighbour counts and overflows of the latest finished frame
+     * 
+     * Updated while SetStatsReadback() or adaptive caps are on.
+     */
+    const NeighbourStats& GetNeighbourStats() const { return neighbourStats; }
+
+    /**
+     * @brief Read the sort, Verlet and neighbour counters back for the getters above, off by
+     *        default since only a display needs them
+     */
+    void SetStatsReadback(bool enabled) { statsReadback = enabled; }
+
+    /**
+     * @brief Size the neighbour cap and the Verlet list slots from the observed counts, or go back
+     *        to the fixed MAX_NEIGHBOURS cap
+     */
+    void SetAdaptiveCaps(bool adaptive);
+
+    bool GetAdaptiveCaps() const { return adaptiveCaps; }
+    int GetNeighbourCap() const { return neighbourCap; }
+    int GetVerletCapacity() const { return verletCapacity; }
+
+    const SubgroupSupport& GetSubgroupSupport() const { return subgroupSupport; }
+
+    /**
+     * @brief Build the scans, appends and counter reductions from subgroup operations, or from
+     *        shared memory and per-thread atomics. Ignored when the driver lacks the support
+     */
+    void SetSubgroups(bool enabled);
+
+    bool GetSubgroups() const { return subgroups; }
+
+    /**
+     * @brief One line naming the subgroup support found and the path the kernels use
+     */
+    std::string SubgroupReport() const;
+
+    /**
+     * @brief Make every run of a scene bitwise identical for a given configuration and driver
+     * 
+     * The hash pass rewrites the spatial index in particle order every substep, so the stable
+     * radix sort leaves equal hashes in index order, and the bitonic sort, which is not stable,
+     * breaks hash ties by particle index to match it. The incremental sort keeps the previous
+     * order instead: its merge puts the entries that kept their hash before the changed ones,
+     * which it sorts by hash then index. That order differs from the other two, but it follows
+     * only from the previous order and the new hashes, so it repeats from run to run. With the
+     * correction reading ping-pong buffers and the counters being integer atomics, the float
+     * summation order no longer depends on scheduling.
+     */
+    void SetDeterministic(bool enabled);
+
+    bool GetDeterministic() const { return deterministic; }
+
+    /**
+     * @brief Copy the particle positions and velocities back from the GPU, stalls until the frame is done
+     */
+    void ReadState(std::vector<float>& positions, std::vector<float>& velocities);
+
     /**
      * @brief Update the particles
      */
@@ -126,8 +632,35 @@ public:
 
     /**
      * @brief Do a bitonic merge sort
+     * 
+     * @param indirectArgs offset of the workgroup count of every step in the bound
+     *                     GL_DISPATCH_INDIRECT_BUFFER, negative to dispatch directly
+     */
+    void BitonicMergeSort(GLintptr indirectArgs = -1);
+
+    /**
+     * @brief Do an LSD radix sort, histogram, scan and stable scatter per digit
+     */
+    void RadixSort();
+
+    /**
+     * @brief Rehash the previous sorted order and repair it
+     * 
+     * Nothing is sorted when no particle changed cell, a handful of changes are merged into
+     * place, and past FIXUP_CAPACITY changes the rehashed index is fully sorted again. The
+     * choice is made on the GPU and applied with indirect dispatches.
      */
-    void BitonicMergeSort();
+    void IncrementalSort();
+
+    /**
+     * @brief Measure how far the particles moved since the Verlet lists were built
+     */
+    void VerletCheck();
+
+    /**
+     * @brief Bin, sort and rebuild the Verlet lists, skipped by empty dispatches while they are fresh
+     */
+    void VerletRebuild();
 
     /**
      * @brief Reset the offsets
@@ -148,4 +681,14 @@ public:
      * @brief Projection and Correction Step
      */
     void ProjectionCorrection();
+
+    /**
+     * @brief External forces, integration and spatial hashing in a single dispatch
+     */
+    void ExForcesIntegrateHash();
+
+    /**
+     * @brief Projection, correction and boundary check in a single dispatch
+     */
+    void ProjectionCorrectionBoundary();
 };
\ No newline at end of file
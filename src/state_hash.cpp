@@ -0,0 +1,68 @@
+#include "state_hash.hpp"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace state{
+    static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+    static const uint64_t FNV_PRIME = 0x100000001b3ull;
+
+    static uint64_t hashBytes(uint64_t hash, const std::vector<float>& values){
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values.data());
+        for (size_t i = 0; i < values.size() * sizeof(float); i++){
+            hash ^= bytes[i];
+            hash *= FNV_PRIME;
+        }
+        return hash;
+    }
+
+    uint64_t Hash(Solver& solver){
+        std::vector<float> positions, velocities;
+        solver.ReadState(positions, velocities);
+        return hashBytes(hashBytes(FNV_OFFSET, positions), velocities);
+    }
+
+    std::vector<uint64_t> Record(Solver& solver, Particles& particles, int frames){
+        solver.SetDeterministic(true);
+        particles.reset();
+
+        std::vector<uint64_t> hashes;
+        hashes.reserve(frames);
+        for (int i = 0; i < frames; i++){
+            solver.Update();
+            hashes.push_back(Hash(solver));
+        }
+        return hashes;
+    }
+
+    void Save(const std::vector<uint64_t>& hashes, std::ostream& out){
+        for (size_t i = 0; i < hashes.size(); i++)
+            out << i << " " << std::hex << std::setw(16) << std::setfill('0') << hashes[i] << std::dec << std::setfill(' ') << "\n";
+        out.flush();
+    }
+
+    bool Load(const std::string& path, std::vector<uint64_t>& hashes){
+        std::ifstream file(path);
+        if (!file) return false;
+
+        hashes.clear();
+        std::string line;
+        while (std::getline(file, line)){
+            std::istringstream fields(line);
+            size_t frame;
+            uint64_t hash;
+            if (fields >> frame >> std::hex >> hash) hashes.push_back(hash);
+        }
+        // an empty or unrelated file must not pass as a reference
+        return !hashes.empty();
+    }
+
+    int FirstMismatch(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b){
+        size_t common = std::min(a.size(), b.size());
+        for (size_t i = 0; i < common; i++)
+            if (a[i] != b[i]) return (int)i;
+        // a truncated run or reference differs from the first frame the other has alone
+        return a.size() == b.size() ? -1 : (int)common;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "particles.hpp"
+#include "solver.hpp"
+
+namespace state{
+    /**
+     * @brief 64-bit FNV-1a hash of the bits of every particle position and velocity
+     * 
+     * Reads the state back from the GPU, so it stalls until the frame is done.
+     */
+    uint64_t Hash(Solver& solver);
+
+    /**
+     * @brief Run the scene from its initial state and hash the state after every frame
+     * 
+     * Turns on the solver's deterministic mode, without it the hashes of two runs need not agree.
+     */
+    std::vector<uint64_t> Record(Solver& solver, Particles& particles, int frames);
+
+    /**
+     * @brief Write one "frame hash" line per frame, hashes in hex
+     */
+    void Save(const std::vector<uint64_t>& hashes, std::ostream& out);
+
+    /**
+     * @brief Read hashes written by Save(), other lines such as startup messages are skipped
+     * 
+     * @return false when the file cannot be read or holds no hashes
+     */
+    bool Load(const std::string& path, std::vector<uint64_t>& hashes);
+
+    /**
+     * @brief First frame whose hashes differ, -1 when both hold the same frames
+     *
+     * When one is shorter, the first frame only the other has counts as the mismatch.
+     */
+    int FirstMismatch(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b);
+}
@@ -0,0 +1,57 @@
+#include "stepper.hpp"
+
+Stepper::Stepper(Solver* _solver, Particles* _particles, int refresh_rate)
+    : solver(_solver), particles(_particles){
+    displayInterval = 1.0 / std::max(refresh_rate, 1);
+    lastTime = lastRenderTime = statsTime = glfwGetTime();
+}
+
+void Stepper::step(){
+    particles->storeFramePositions();
+    solver->Update();
+    framesSimulated++;
+    statsFrames++;
+}
+
+bool Stepper::advance(){
+    double now = glfwGetTime();
+    double elapsed = now - lastTime;
+    lastTime = now;
+
+    if (now - statsTime >= 1.0){
+        simFramesPerSecond = statsFrames / (now - statsTime);
+        statsFrames = 0;
+        statsTime = now;
+    }
+
+    if (paused){
+        accumulator = 0.0;
+        alpha = 1.0f;
+        return true;
+    }
+
+    if (unthrottled){
+        // as many frames as the GPU accepts, the latest one is always shown
+        step();
+        alpha = 1.0f;
+        accumulator = 0.0;
+        if (now - lastRenderTime < displayInterval) return false;
+        lastRenderTime = now;
+        return true;
+    }
+
+    const double frameTime = Solver::FrameTime();
+    accumulator += elapsed;
+    int frames = 0;
+    while (accumulator >= frameTime && frames < maxCatchUpFrames){
+        step();
+        accumulator -= frameTime;
+        frames++;
+    }
+    // drop the backlog instead of spiralling when the simulation cannot keep up
+    if (accumulator >= frameTime) accumulator = 0.0;
+
+    alpha = (float)(accumulator / frameTime);
+    lastRenderTime = now;
+    return true;
+}
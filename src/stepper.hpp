@@ -0,0 +1,67 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include "particles.hpp"
+#include "solver.hpp"
+
+/**
+ * @class Stepper
+ * @brief Decouples simulation stepping from the render loop
+ * 
+ * In the default mode simulation frames are produced by a fixed timestep accumulator, so the
+ * simulation runs in real time whatever the display rate is, and the renderer interpolates
+ * between the previous and the latest frame. In unthrottled mode a frame is simulated on every
+ * loop iteration and rendering only happens once per display interval.
+ */
+class Stepper
+{
+private:
+    Solver* solver;
+    Particles* particles;
+
+    double accumulator = 0.0;
+    double lastTime;
+    double lastRenderTime;
+    double displayInterval;
+    float alpha = 1.0f;
+
+    // statistics over the last second
+    double statsTime;
+    size_t statsFrames = 0;
+    float simFramesPerSecond = 0.0f;
+
+    /**
+     * @brief Simulate a single frame, keeping the previous positions for interpolation
+     */
+    void step();
+
+public:
+    // upper bound of frames simulated per iteration, so a slow frame cannot snowball
+    int maxCatchUpFrames = 4;
+    bool unthrottled = false;
+    bool paused = false;
+    size_t framesSimulated = 0;
+
+public:
+    /**
+     * @param refresh_rate The display refresh rate in Hz
+     */
+    Stepper(Solver* _solver, Particles* _particles, int refresh_rate);
+
+    /**
+     * @brief Advance the simulation up to the current time
+     * 
+     * @return true if a frame should be rendered on this iteration
+     */
+    bool advance();
+
+    /**
+     * @brief Interpolation factor between the previous and the latest simulated frame
+     */
+    float getAlpha() const { return alpha; }
+
+    /**
+     * @brief Simulated frames per second of wall-clock time
+     */
+    float getSimFramesPerSecond() const { return simFramesPerSecond; }
+};
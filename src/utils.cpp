@@ -1,4 +1,5 @@
 #include "utils.hpp"
+#include "shader.hpp"
 
 
 const char * setGLSLVersion(){
@@ -25,7 +26,12 @@ int openGLInit(){
     #if defined(IMGUI_IMPL_OPENGL_LOADER_GL3W)
         bool err = gl3wInit() != 0;
     #elif defined(IMGUI_IMPL_OPENGL_LOADER_GLEW)
-        bool err = glewInit() != GLEW_OK;
+        GLenum glewStatus = glewInit();
+        bool err = glewStatus != GLEW_OK;
+        #ifdef GLEW_ERROR_NO_GLX_DISPLAY
+            // on a surfaceless context only the GLX entry points are missing
+            err = err && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY;
+        #endif
     #elif defined(IMGUI_IMPL_OPENGL_LOADER_GLAD)
         bool err = gladLoadGL() == 0;
     #elif defined(IMGUI_IMPL_OPENGL_LOADER_GLAD2)
@@ -46,6 +52,9 @@ int openGLInit(){
         exit(1);
     }
 
+    // Shader programs built back to back are compiled concurrently where supported
+    Shader::enableParallelCompile();
+
     //Enable multisampling
     glEnable(GL_MULTISAMPLE);
 
@@ -53,8 +62,8 @@ int openGLInit(){
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    // Set point size
-    glPointSize(10.0f);
+    // Point size is written by the vertex shader
+    glEnable(GL_PROGRAM_POINT_SIZE);
 
     // Enable smooth point rendering
     glEnable(GL_LINE_SMOOTH);
@@ -74,12 +83,23 @@ static void glfwErrorCallback(int error, const char* description)
 }
 
 namespace utils{
-    GLFWwindow* setupWindow(int width, int height)
+    GLFWwindow* setupWindow(int width, int height, bool headless)
     {
         // Setup window
         glfwSetErrorCallback(glfwErrorCallback);
-        if (!glfwInit())
-            exit(0);
+        // a run that cannot get the context it asked for must not exit 0, scripts read that as a pass
+        if (headless){
+    #ifdef GLFW_PLATFORM_NULL
+            glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    #else
+            fprintf(stderr, "Headless runs need GLFW 3.4 or later for the null platform\n");
+            exit(1);
+    #endif
+        }
+        if (!glfwInit()){
+            fprintf(stderr, "Failed to initialize GLFW\n");
+            exit(1);
+        }
 
         // Decide GL+GLSL versions
         const char * glsl_version = setGLSLVersion();
@@ -87,11 +107,18 @@ namespace utils{
 
         // Create window with graphics context
         glfwWindowHint(GLFW_SAMPLES, 4);
+        if (headless){
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        }
         GLFWwindow* window = glfwCreateWindow(width, height, "PCISPH", NULL, NULL);
-        if (window == NULL)
-            exit(0);
+        if (window == NULL){
+            fprintf(stderr, "Failed to create a %s OpenGL 4.6 context\n", headless ? "surfaceless EGL" : "windowed");
+            glfwTerminate();
+            exit(1);
+        }
         glfwMakeContextCurrent(window);
-        glfwSwapInterval(1); // Enable vsync
+        if (!headless) glfwSwapInterval(1); // Enable vsync
 
         // Initialize OpenGL loader
         int status = openGLInit();
@@ -99,6 +126,7 @@ namespace utils{
             std::cout << "Initialized OpenGL Succesfully " << std::endl;
         }
         std::cout<< "OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
+        std::cout<< "OpenGL Renderer: " << glGetString(GL_RENDERER) << std::endl;
 
         // Setup Dear ImGui context
         IMGUI_CHECKVERSION();
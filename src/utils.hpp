@@ -53,6 +53,12 @@ using namespace gl;
 // Our functions are prototyped starting here
 
 namespace utils{
-    GLFWwindow* setupWindow(int, int);
+    /**
+     * @brief Create the window, its GL context and the ImGui context
+     * 
+     * A headless window has no surface: with GLFW 3.4 it runs on the null platform with an EGL
+     * context, which Mesa creates on its surfaceless platform, so no display is needed.
+     */
+    GLFWwindow* setupWindow(int, int, bool headless = false);
     void cleanup(GLFWwindow* );
 }
\ No newline at end of file
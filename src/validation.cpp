@@ -0,0 +1,239 @@
+#include "validation.hpp"
+#include "cpu_reference.hpp"
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+static std::vector<float> readBuffer(unsigned int buffer, size_t count){
+    std::vector<float> values(count);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(float), values.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return values;
+}
+
+static glm::vec2 at(const std::vector<float>& values, size_t i){
+    return glm::vec2(values[2 * i], values[2 * i + 1]);
+}
+
+static void store(std::vector<float>& values, size_t i, glm::vec2 value){
+    values[2 * i] = value.x;
+    values[2 * i + 1] = value.y;
+}
+
+Validator::Validator(Solver* _solver, Particles* _particles) : solver(_solver), particles(_particles){
+}
+
+Validator::State Validator::Read(){
+    size_t n = particles->num_particles;
+    State state;
+    solver->ReadState(state.positions, state.velocities);
+    state.previousPositions = readBuffer(particles->previousPositionSSBO, 2 * n);
+    state.pressures = readBuffer(particles->pressureSSBO, n);
+    state.pvs = readBuffer(particles->pvSSBO, n);
+    return state;
+}
+
+void Validator::Integrate(State& state) const{
+    for (size_t i = 0; i < particles->num_particles; i++){
+        glm::vec2 position = at(state.positions, i);
+        glm::vec2 velocity = at(state.velocities, i);
+        store(state.previousPositions, i, position);
+
+        velocity += solver->GRAVITY * Solver::DT;
+        position += velocity * Solver::DT;
+        store(state.positions, i, position);
+        store(state.velocities, i, velocity);
+    }
+}
+
+void Validator::PressureSolve(State& state) const{
+    const cpu::PairConstants c = solver->CpuConstants();
+    const auto& boundary = particles->boundary_positions;
+
+    for (size_t i = 0; i < particles->num_particles; i++){
+        glm::vec2 position = at(state.positions, i);
+        float density = 0.0f;
+        float dv = 0.0f;
+
+        for (size_t j = 0; j < particles->num_particles; j++){
+            glm::vec2 diff = at(state.positions, j) - position;
+            float a;
+            if (!cpu::FluidWeight(c, glm::dot(diff, diff), a)) continue;
+
+            density += c.mass * c.kernelFactor * a * a * a;
+            dv += c.mass * c.kernelNorm * a * a * a * a;
+        }
+        for (size_t b = 0; b < particles->num_boundary_particles; b++){
+            glm::vec2 diff = at(boundary, b) - position;
+            float a3 = 0.0f, a4 = 0.0f;
+            cpu::WallDensity(c, glm::dot(diff, diff), a3, a4);
+            density += c.boundaryMass * c.kernelFactor * a3;
+            dv += c.boundaryMass * c.kernelNorm * a4;
+        }
+
+        state.pressures[i] = Solver::STIFFNESS * (density - solver->REST_DENSITY * c.mass);
+        state.pvs[i] = Solver::STIFF_APPROX * dv;
+    }
+}
+
+void Validator::ProjectionCorrection(State& state, bool wallKick) const{
+    const cpu::PairConstants c = solver->CpuConstants();
+    const cpu::Walls walls = solver->CpuWalls();
+    const auto& boundary = particles->boundary_positions;
+
+    // every particle sees the state before the pass, like the ping-pong buffers give the kernel
+    State out = state;
+    for (size_t i = 0; i < particles->num_particles; i++){
+        glm::vec2 position = at(state.positions, i);
+        glm::vec2 velocity = at(state.velocities, i);
+        float pressure = state.pressures[i];
+        float pv = state.pvs[i];
+        glm::vec2 correction(0.0f);
+
+        for (size_t j = 0; j < particles->num_particles; j++){
+            glm::vec2 dx = at(state.positions, j) - position;
+            float r2 = glm::dot(dx, dx);
+            if (r2 > c.h2 || r2 < c.eta2) continue;
+
+            glm::vec2 dv = at(state.velocities, j) - velocity;
+            correction += dx * cpu::FluidCorrection(c, dx.x, dx.y, r2, dv.x, dv.y, pressure + state.pressures[j], pv * state.pvs[j]);
+        }
+        for (size_t b = 0; b < particles->num_boundary_particles; b++){
+            glm::vec2 dx = at(boundary, b) - position;
+            correction += dx * cpu::WallCorrection(c, glm::dot(dx, dx), pressure, pv);
+        }
+
+        // summed apart from the position like the kernel does
+        glm::vec2 predicted = position + correction;
+
+        glm::vec2 corrected = (predicted - at(state.previousPositions, i)) / c.dt;
+        if (wallKick) cpu::WallKick(walls, predicted.x, predicted.y, corrected.x, corrected.y);
+        store(out.positions, i, predicted);
+        store(out.velocities, i, corrected);
+    }
+    state = std::move(out);
+}
+
+void Validator::BoundaryCheck(State& state) const{
+    const cpu::Walls walls = solver->CpuWalls();
+    for (size_t i = 0; i < particles->num_particles; i++)
+        cpu::WallKick(walls, state.positions[2 * i], state.positions[2 * i + 1], state.velocities[2 * i], state.velocities[2 * i + 1]);
+}
+
+std::vector<float> Validator::PositionRounding(const std::vector<float>& positions, float per){
+    std::vector<float> rounding(positions.size());
+    for (size_t i = 0; i < positions.size(); i++){
+        float magnitude = std::abs(positions[i]);
+        rounding[i] = ROUNDING_ULPS * (std::nextafter(magnitude, INFINITY) - magnitude) * per;
+    }
+    return rounding;
+}
+
+void Validator::Compare(const std::string& pass, const std::string& field, size_t substep,
+                        const std::vector<float>& gpu, const std::vector<float>& cpu, const std::vector<float>* origin,
+                        const std::vector<float>* rounding){
+    auto value = [origin](const std::vector<float>& values, size_t i){ return values[i] - (origin ? (*origin)[i] : 0.0f); };
+
+    float scale = 0.0f;
+    for (size_t i = 0; i < cpu.size(); i++) scale = std::max(scale, std::abs(value(cpu, i)));
+    scale = std::max(scale, 1e-12f);
+
+    if (std::find(passOrder.begin(), passOrder.end(), pass) == passOrder.end()) passOrder.push_back(pass);
+    FieldError& worst = errors[pass][field];
+    for (size_t i = 0; i < cpu.size(); i++){
+        double difference = std::abs(value(gpu, i) - value(cpu, i));
+        if (rounding) difference = std::max(difference - (*rounding)[i], 0.0);
+        double error = difference / scale;
+        if (error <= worst.error) continue;
+
+        // vec2 fields report the particle, not the component
+        size_t particle = cpu.size() == particles->num_particles ? i : i / 2;
+        worst = {error, substep, particle, gpu[i], cpu[i]};
+        if (error > TOLERANCE && !diverged){
+            diverged = true;
+            std::cout << "First divergence: substep " << substep << ", " << pass << ", " << field
+                      << " of particle " << particle << ": GPU " << gpu[i] << ", CPU " << cpu[i]
+                      << " (" << error << " of the largest value)" << std::endl;
+        }
+    }
+}
+
+bool Validator::Run(int frames){
+    int cap = solver->neighbourCap;
+    bool adaptive = solver->adaptiveCaps;
+    solver->neighbourCap = Solver::MAX_NEIGHBOUR_CAP;
+    solver->adaptiveCaps = false;
+
+    passOrder.clear();
+    errors.clear();
+    diverged = false;
+
+    particles->reset();
+    solver->passGraph.Flush();
+    State before = Read();
+    size_t substep = 0;
+
+    solver->passGraph.SetObserver([&](const std::string& pass){
+        State after = Read();
+        State expected = before;
+
+        if (pass == "External Forces" || pass == "Integrate Hash"){
+            Integrate(expected);
+            std::vector<float> rounding = PositionRounding(expected.positions, 1.0f);
+            Compare(pass, "position", substep, after.positions, expected.positions, &before.positions, &rounding);
+            Compare(pass, "velocity", substep, after.velocities, expected.velocities);
+            Compare(pass, "previous position", substep, after.previousPositions, expected.previousPositions);
+        }
+        else if (pass == "Pressure Solve"){
+            PressureSolve(expected);
+            // the kernel keeps the pressure, density = pressure / stiffness + rest density
+            std::vector<float> gpuDensity(after.pressures.size()), cpuDensity(expected.pressures.size());
+            for (size_t i = 0; i < gpuDensity.size(); i++){
+                gpuDensity[i] = after.pressures[i] / Solver::STIFFNESS + solver->REST_DENSITY * solver->PARTICLE_MASS;
+                cpuDensity[i] = expected.pressures[i] / Solver::STIFFNESS + solver->REST_DENSITY * solver->PARTICLE_MASS;
+            }
+            Compare(pass, "density", substep, gpuDensity, cpuDensity);
+            Compare(pass, "pressure", substep, after.pressures, expected.pressures);
+            Compare(pass, "pv", substep, after.pvs, expected.pvs);
+        }
+        else if (pass == "Projection Correction" || pass == "Correct Boundary"){
+            ProjectionCorrection(expected, pass == "Correct Boundary");
+            // the velocity is the corrected position's displacement over dt
+            std::vector<float> rounding = PositionRounding(expected.positions, 1.0f);
+            std::vector<float> velocityRounding = PositionRounding(expected.positions, 1.0f / Solver::DT);
+            Compare(pass, "position", substep, after.positions, expected.positions, &before.positions, &rounding);
+            Compare(pass, "velocity", substep, after.velocities, expected.velocities, nullptr, &velocityRounding);
+        }
+        else if (pass == "Boundary Check"){
+            BoundaryCheck(expected);
+            Compare(pass, "velocity", substep, after.velocities, expected.velocities);
+        }
+
+        // both end a substep
+        if (pass == "Boundary Check" || pass == "Correct Boundary") substep++;
+        before = std::move(after);
+    });
+
+    for (int i = 0; i < frames; i++) solver->Update();
+    solver->passGraph.SetObserver(nullptr);
+
+    // the frames in flight counted under the validation cap
+    solver->neighbourCap = cap;
+    solver->adaptiveCaps = adaptive;
+    solver->neighbourReadback.generation++;
+    return !diverged;
+}
+
+void Validator::Print() const{
+    std::cout << std::left << std::setw(24) << "Pass" << std::setw(20) << "Field"
+              << std::right << std::setw(12) << "Max error" << std::setw(10) << "Substep" << std::setw(10) << "Particle" << std::endl;
+    for (const auto& pass : passOrder){
+        for (const auto& [field, worst] : errors.at(pass)){
+            std::cout << std::left << std::setw(24) << pass << std::setw(20) << field << std::right
+                      << std::scientific << std::setprecision(2) << std::setw(12) << worst.error << std::defaultfloat
+                      << std::setw(10) << worst.substep << std::setw(10) << worst.particle
+                      << (worst.error > TOLERANCE ? "  over tolerance" : "") << std::endl;
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include "particles.hpp"
+#include "solver.hpp"
+
+/**
+ * @class Validator
+ * @brief Checks every solver pass against a straightforward CPU reference
+ *
+ * After each pass that changes the particle state the GPU buffers are read back and compared
+ * with the reference applied to the state the GPU had before the pass, so an error is caught
+ * in the pass that made it instead of after it spread. The reference tests every particle
+ * pair, no grid, no sorting and no shared memory, in the solver's float arithmetic.
+ */
+class Validator
+{
+private:
+    Solver* solver;
+    Particles* particles;
+
+    /**
+     * @brief Particle state the passes read and write, interleaved vec2 for the vectors
+     */
+    struct State
+    {
+        std::vector<float> positions;
+        std::vector<float> velocities;
+        std::vector<float> previousPositions;
+        std::vector<float> pressures;
+        std::vector<float> pvs;
+    };
+
+    /**
+     * @brief Largest error of a field in a pass, relative to the largest reference value
+     */
+    struct FieldError
+    {
+        double error = 0.0;
+        size_t substep = 0;
+        size_t particle = 0;
+        float gpu = 0.0f;
+        float cpu = 0.0f;
+    };
+
+    // pass -> field -> worst error, in the order the passes first ran
+    std::vector<std::string> passOrder;
+    std::map<std::string, std::map<std::string, FieldError>> errors;
+    bool diverged = false;
+
+    State Read();
+
+    // reference of each pass, in place on the state before it
+    void Integrate(State& state) const;
+    void PressureSolve(State& state) const;
+    void ProjectionCorrection(State& state, bool wallKick) const;
+    void BoundaryCheck(State& state) const;
+
+    /**
+     * @brief Compare a field, reporting the first value out of tolerance
+     *
+     * @param origin Subtracted from both before comparing, the input positions so a pass is
+     *               judged by how far it moved the particles rather than where they are
+     * @param rounding Per value, the part of a difference that is float rounding and not counted
+     */
+    void Compare(const std::string& pass, const std::string& field, size_t substep,
+                 const std::vector<float>& gpu, const std::vector<float>& cpu, const std::vector<float>* origin = nullptr,
+                 const std::vector<float>* rounding = nullptr);
+
+    /**
+     * @brief ROUNDING_ULPS units in the last place of every position, scaled by per
+     */
+    static std::vector<float> PositionRounding(const std::vector<float>& positions, float per);
+
+public:
+    // largest difference accepted, relative to the largest reference value of the field
+    constexpr static double TOLERANCE = 1e-3;
+
+    // Positions are stored absolute in float, and once the fluid settles a substep moves them by
+    // only tens of ulps. Both sides sum the correction apart and round position + correction once,
+    // which can land one ulp apart; that much of a position, and of the velocity derived from it,
+    // is rounding. The second ulp is margin.
+    constexpr static float ROUNDING_ULPS = 2.0f;
+
+    Validator(Solver* _solver, Particles* _particles);
+
+    /**
+     * @brief Run the scene from its initial state and check every pass of every substep
+     *
+     * The neighbour cap is raised to Solver::MAX_NEIGHBOUR_CAP for the run so no neighbourhood
+     * is truncated, the reference has no neighbour order to truncate in.
+     *
+     * @return true when every pass stayed within TOLERANCE
+     */
+    bool Run(int frames);
+
+    /**
+     * @brief Print the worst error of every pass and field
+     */
+    void Print() const;
+};